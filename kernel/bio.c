@@ -1,10 +1,14 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// Beyond NBUF static buffers, the cache grows by a page of
+// buffers at a time while memory is plentiful (kmemplenty()),
+// and gives pages back when kalloc() runs out (bshrink()).
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
@@ -22,15 +26,45 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "memstat.h"
 
-struct {
+#define NBUCKET 13
+#define BPERPAGE (PGSIZE / BSIZE - 1)
+
+// a page from kalloc() holding buffers: this header in the
+// first BSIZE bytes, then the buffers' data.
+struct bufpage {
+  struct bufpage *next;
+  struct buf buf[BPERPAGE];
+};
+
+// a hash chain of buffers, by (dev, blockno), and the lock
+// that guards the chain and its buffers' dev, blockno and
+// refcnt.
+struct bucket {
   struct spinlock lock;
+  struct buf *head;   // through hnext
+};
+
+struct {
+  struct bucket bucket[NBUCKET];
   struct buf buf[NBUF];
+  uchar data[NBUF][BSIZE];
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
+  // the buffers no one holds (refcnt 0), through prev/next,
+  // sorted by how recently they were released: head.next is
+  // most recent, head.prev is least. guarded by lru, which is
+  // taken after a bucket lock.
+  struct spinlock lru;
   struct buf head;
+  int nwaiting;   // in bget(), for the list to be non-empty
+
+  // held while taking a buffer for a new block, which needs
+  // two bucket locks; it keeps two evictions from locking
+  // buckets in opposite orders. also guards the list of
+  // pages the cache has grown by.
+  struct spinlock evict;
+  struct bufpage *pages;
 } bcache;
 
 void
@@ -38,12 +72,18 @@ binit(void)
 {
   struct buf *b;
 
-  initlock(&bcache.lock, "bcache");
+  for(int i = 0; i < NBUCKET; i++)
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
+  initlock(&bcache.lru, "bcache.lru");
+  initlock(&bcache.evict, "bcache.evict");
+  if(sizeof(struct bufpage) > BSIZE)
+    panic("binit: bufpage");
 
-  // Create linked list of buffers
+  // every buffer starts free, and in no hash chain.
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
+    b->data = bcache.data[b - bcache.buf];
     b->next = bcache.head.next;
     b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
@@ -52,40 +92,261 @@ binit(void)
   }
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+static struct bucket*
+bucketof(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+// Find the block in bk and take a reference to it, or
+// return 0. Called with bk->lock held.
 static struct buf*
-bget(uint dev, uint blockno)
+bfind(struct bucket *bk, uint dev, uint blockno)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head; b; b = b->hnext){
     if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
+      if(b->refcnt++ == 0){
+        acquire(&bcache.lru);
+        b->next->prev = b->prev;
+        b->prev->next = b->next;
+        release(&bcache.lru);
+      }
       return b;
     }
   }
+  return 0;
+}
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+// Drop a reference to b, making it a candidate for reuse if it
+// was the last.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk = bucketof(b->dev, b->blockno);
+
+  acquire(&bk->lock);
+  if(--b->refcnt == 0){
+    acquire(&bcache.lru);
+    b->next = bcache.head.next;
+    b->prev = &bcache.head;
+    bcache.head.next->prev = b;
+    bcache.head.next = b;
+    if(bcache.nwaiting)
+      wakeup(&bcache.head);
+    release(&bcache.lru);
+  }
+  release(&bk->lock);
+}
+
+// Take b out of vk's hash chain, if it is in one: a buffer
+// that has never held a block is in none.
+static void
+bunhash(struct bucket *vk, struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp = &vk->head; *pp; pp = &(*pp)->hnext){
+    if(*pp == b){
+      *pp = b->hnext;
+      break;
+    }
+  }
+}
+
+// Take the least recently used free buffer for the block,
+// which bk, whose lock the caller holds along with
+// bcache.evict, lacks. Returns 0 if every buffer is in use.
+static struct buf*
+brecycle(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+  struct bucket *vk;
+
+  for(;;){
+    acquire(&bcache.lru);
+    b = bcache.head.prev;
+    release(&bcache.lru);
+    if(b == &bcache.head)
+      return 0;
+    // a buffer changes blocks only here, under bcache.evict,
+    // but may be taken once lru is released.
+    vk = bucketof(b->dev, b->blockno);
+    if(vk != bk)
+      acquire(&vk->lock);
+    if(b->refcnt == 0)
+      break;
+    if(vk != bk)
+      release(&vk->lock);
+  }
+
+  acquire(&bcache.lru);
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+  release(&bcache.lru);
+  bunhash(vk, b);
+  if(vk != bk)
+    release(&vk->lock);
+
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  b->hnext = bk->head;
+  bk->head = b;
+  return b;
+}
+
+// Add a page's worth of empty buffers to the cache, at the
+// least recently used end of the free list, so that the
+// caller's miss takes one instead of evicting a block.
+// Called with no bcache lock held, since kalloctype() may
+// call bshrink(). Returns 0, or -1 if memory is short.
+static int
+bgrow(void)
+{
+  struct bufpage *pg;
+
+  if((pg = kalloctype(KMEM_FILE)) == 0)
+    return -1;
+  memset(pg, 0, sizeof(*pg));
+  for(int i = 0; i < BPERPAGE; i++){
+    pg->buf[i].data = (uchar*)pg + (i+1)*BSIZE;
+    initsleeplock(&pg->buf[i].lock, "buffer");
+  }
+
+  acquire(&bcache.evict);
+  pg->next = bcache.pages;
+  bcache.pages = pg;
+  acquire(&bcache.lru);
+  for(int i = 0; i < BPERPAGE; i++){
+    struct buf *b = &pg->buf[i];
+    b->prev = bcache.head.prev;
+    b->next = &bcache.head;
+    bcache.head.prev->next = b;
+    bcache.head.prev = b;
+  }
+  if(bcache.nwaiting)
+    wakeup(&bcache.head);
+  release(&bcache.lru);
+  release(&bcache.evict);
+  return 0;
+}
+
+// Take pg's buffers out of the cache if no one holds any of
+// them, and return 1; else return 0. Called with bcache.evict
+// held, which lets it hold several bucket locks.
+static int
+bpagetake(struct bufpage *pg)
+{
+  struct bucket *held[BPERPAGE], *vk;
+  int nheld = 0, free = 1, j;
+
+  for(int i = 0; i < BPERPAGE; i++){
+    vk = bucketof(pg->buf[i].dev, pg->buf[i].blockno);
+    for(j = 0; j < nheld && held[j] != vk; j++)
+      ;
+    if(j == nheld){
+      acquire(&vk->lock);
+      held[nheld++] = vk;
+    }
+    if(pg->buf[i].refcnt != 0)
+      free = 0;
+  }
+  if(free){
+    acquire(&bcache.lru);
+    for(int i = 0; i < BPERPAGE; i++){
+      pg->buf[i].next->prev = pg->buf[i].prev;
+      pg->buf[i].prev->next = pg->buf[i].next;
+    }
+    release(&bcache.lru);
+    for(int i = 0; i < BPERPAGE; i++)
+      bunhash(bucketof(pg->buf[i].dev, pg->buf[i].blockno), &pg->buf[i]);
+  }
+  for(j = 0; j < nheld; j++)
+    release(&held[j]->lock);
+  return free;
+}
+
+// Give back up to npages of the cache's pages whose buffers
+// no one holds, for kalloctype() when memory runs out. their
+// blocks need no writing, since bwrite() writes through.
+// Returns the number of pages freed.
+int
+bshrink(int npages)
+{
+  struct bufpage *pg, **pp;
+  int n = 0;
+
+  if(bcache.pages == 0)   // nothing to give, or before binit()
+    return 0;
+  acquire(&bcache.evict);
+  for(pp = &bcache.pages; (pg = *pp) != 0 && n < npages; ){
+    if(bpagetake(pg)){
+      *pp = pg->next;
+      kfree(pg);
+      n++;
+    } else {
+      pp = &pg->next;
     }
   }
-  panic("bget: no buffers");
+  release(&bcache.evict);
+  return n;
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return the buffer, referenced but not
+// locked, or 0 if every buffer is in use.
+// A hit locks only the block's hash bucket, so hits on
+// different harts proceed in parallel.
+static struct buf*
+bref(uint dev, uint blockno)
+{
+  struct bucket *bk = bucketof(dev, blockno);
+  struct buf *b;
+
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b)
+    return b;
+
+  // Not cached. grow the cache rather than evict while memory
+  // is plentiful. another process may add the block while no
+  // lock is held, so look again.
+  if(kmemplenty())
+    bgrow();
+  acquire(&bcache.evict);
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) == 0)
+    b = brecycle(bk, dev, blockno);
+  release(&bk->lock);
+  release(&bcache.evict);
+  return b;
+}
+
+// Return a locked buffer for the block. if every buffer is
+// held, as by reads and writes in flight, grow the cache even
+// though memory is short, or else wait for one to be released.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  while((b = bref(dev, blockno)) == 0){
+    if(bgrow() == 0)
+      continue;
+    acquire(&bcache.lru);
+    bcache.nwaiting++;
+    while(bcache.head.prev == &bcache.head)
+      sleep(&bcache.head, &bcache.lru);
+    bcache.nwaiting--;
+    release(&bcache.lru);
+  }
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -102,6 +363,107 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// the end of a read breadahead() started: the buffer's lock
+// and reference pass to no one. called from the disk
+// interrupt.
+static void
+breaddone(struct buf *b)
+{
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b);
+}
+
+// Start the disk on the n locked bufs in bs, as few requests
+// as runs of consecutive blocks allow, without waiting.
+static void
+bstart(struct buf **bs, int n, int write)
+{
+  int i, j;
+
+  for(i = 0; i < n; i = j){
+    for(j = i + 1; j < n && j - i < MAXIOBLOCKS; j++)
+      if(bs[j]->dev != bs[i]->dev || bs[j]->blockno != bs[i]->blockno + (j - i))
+        break;
+    virtio_disk_startv(bs + i, j - i, write);
+  }
+}
+
+// Start reading n blocks from blockno that are likely to be
+// bread() soon, without waiting for them, in as few requests
+// as the blocks not already cached allow; bread() then waits
+// on the buffer's lock. does nothing if memory is short, when
+// buffers in flight would crowd out those bget() needs.
+// buffers are locked in increasing block order, so two
+// readaheads cannot each wait for a buffer the other holds.
+void
+breadahead(uint dev, uint blockno, uint n)
+{
+  struct buf *bs[MAXIOBLOCKS], *b;
+  struct bucket *bk;
+  int nb = 0;
+
+  if(!kmemplenty())
+    return;
+  for(uint bn = blockno; bn < blockno + n; bn++){
+    bk = bucketof(dev, bn);
+    acquire(&bk->lock);
+    for(b = bk->head; b; b = b->hnext)
+      if(b->dev == dev && b->blockno == bn)
+        break;
+    release(&bk->lock);
+    if(b || (b = bref(dev, bn)) == 0)
+      continue;
+    acquiresleep(&b->lock);
+    if(b->valid){
+      // someone else read it meanwhile.
+      releasesleep(&b->lock);
+      bput(b);
+      continue;
+    }
+    b->iodone = breaddone;
+    bs[nb++] = b;
+    if(nb == MAXIOBLOCKS){
+      bstart(bs, nb, 0);
+      nb = 0;
+    }
+  }
+  bstart(bs, nb, 0);
+}
+
+// Return a locked buffer for a block that the caller will
+// overwrite whole, without reading it from disk.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  b->valid = 1;
+  return b;
+}
+
+// Write the n locked bufs in bs to disk, in as few requests
+// as runs of consecutive blocks allow, and wait for them all.
+// sorts bs by block number, to find the runs.
+void
+bwritev(struct buf **bs, int n)
+{
+  for(int i = 0; i < n; i++){
+    struct buf *b = bs[i];
+    int j;
+    if(!holdingsleep(&b->lock))
+      panic("bwritev");
+    b->iodone = 0;
+    for(j = i; j > 0 && bs[j-1]->blockno > b->blockno; j--)
+      bs[j] = bs[j-1];
+    bs[j] = b;
+  }
+  bstart(bs, n, 1);
+  for(int i = 0; i < n; i++)
+    virtio_disk_wait(bs[i]);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -120,34 +482,19 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
-
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bucketof(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
-  b->refcnt--;
-  release(&bcache.lock);
+  bput(b);
 }
-
-
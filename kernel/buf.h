@@ -5,8 +5,10 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  struct buf *prev; // LRU list of free buffers
   struct buf *next;
-  uchar data[BSIZE];
+  struct buf *hnext; // hash bucket chain
+  void (*iodone)(struct buf*); // called when an async request is done
+  uchar *data;       // BSIZE bytes
 };
 
@@ -0,0 +1,191 @@
+//
+// Directory entry cache, for path lookup without inode locks.
+//
+// namex() records each name it finds in a directory here, as
+// (device, directory inode number, name) -> inode number, and
+// later lookups walk the cached part of a path under
+// rcu_read_lock(), locking no inode. an entry is added only by
+// a lookup holding the directory's inode lock, and removed by
+// unlink() holding the same lock, so the cache never holds a
+// name that the directory no longer has. readers may still be
+// looking at an entry after it is removed, so its memory is
+// reused only once rcuelapsed() says so (see rcu.c).
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+
+#define NDENTRY 256
+#define NDHASH 64
+
+enum { DFREE, DLIVE, DRETIRED };
+
+struct dentry {
+  uint dev;
+  uint dir;              // inode number of the directory
+  char name[DIRSIZ] __attribute__((nonstring));
+  uint inum;             // inode the name is linked to
+  struct dentry *next;   // hash chain, which readers follow
+  int state;
+  uint64 retired;        // epoch it was removed in, if DRETIRED
+};
+
+struct {
+  struct spinlock lock;  // serializes writers
+  struct dentry *hash[NDHASH];
+  struct dentry dentry[NDENTRY];
+  int hand;              // next entry to consider reusing
+} dcache;
+
+void
+dcacheinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static uint
+dhash(uint dev, uint dir, char *name)
+{
+  uint h = dev * 31 + dir;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDHASH;
+}
+
+// The inode number name is linked to in directory dir, or 0 if
+// it is not cached. Called between rcu_read_lock() and
+// rcu_read_unlock().
+uint
+dcachelookup(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  d = *(struct dentry * volatile *)&dcache.hash[dhash(dev, dir, name)];
+  for(; d; d = *(struct dentry * volatile *)&d->next)
+    if(d->dev == dev && d->dir == dir && namecmp(name, d->name) == 0)
+      return d->inum;
+  return 0;
+}
+
+// Take d out of its hash chain. readers on it can still follow
+// d->next. the caller sets d->retired, after a new epoch.
+// Called with dcache.lock held.
+static void
+dunlink(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dhash(d->dev, d->dir, d->name)]; *pp != d; pp = &(*pp)->next)
+    ;
+  *pp = d->next;
+  d->state = DRETIRED;
+  d->retired = 0;
+}
+
+// An entry to fill in: a free one, or one retired long enough
+// ago that no reader can still see it. if there is none,
+// retire a live entry, for a later call, and return 0.
+// Called with dcache.lock held.
+static struct dentry*
+dalloc(void)
+{
+  struct dentry *d;
+
+  for(int n = 0; n < NDENTRY; n++){
+    d = &dcache.dentry[dcache.hand];
+    dcache.hand = (dcache.hand + 1) % NDENTRY;
+    if(d->state == DFREE || (d->state == DRETIRED && rcuelapsed(d->retired)))
+      return d;
+  }
+  d = &dcache.dentry[dcache.hand];
+  dcache.hand = (dcache.hand + 1) % NDENTRY;
+  if(d->state == DLIVE){
+    dunlink(d);
+    d->retired = rcuretire();
+  }
+  return 0;
+}
+
+// Record that name in directory dp is linked to inode inum.
+// Called with dp locked, so that unlink() cannot remove the
+// name meanwhile.
+void
+dcacheadd(struct inode *dp, char *name, uint inum)
+{
+  struct dentry *d;
+  uint h = dhash(dp->dev, dp->inum, name);
+
+  acquire(&dcache.lock);
+  for(d = dcache.hash[h]; d; d = d->next)
+    if(d->dev == dp->dev && d->dir == dp->inum && namecmp(name, d->name) == 0)
+      goto out;
+  if((d = dalloc()) == 0)
+    goto out;
+  d->dev = dp->dev;
+  d->dir = dp->inum;
+  strncpy(d->name, name, DIRSIZ);
+  d->inum = inum;
+  d->state = DLIVE;
+  d->next = dcache.hash[h];
+  // a reader that finds d must see it filled in.
+  __sync_synchronize();
+  dcache.hash[h] = d;
+out:
+  release(&dcache.lock);
+}
+
+// Forget name in directory dp, which unlink() has just removed,
+// and wait until no lookup can still be about to take a
+// reference to the inode it named, so that the inode's last
+// iput() may free it. Called with dp locked.
+void
+dcacheremove(struct inode *dp, char *name)
+{
+  struct dentry *d;
+  uint64 e = 0;
+
+  acquire(&dcache.lock);
+  for(d = dcache.hash[dhash(dp->dev, dp->inum, name)]; d; d = d->next){
+    if(d->dev == dp->dev && d->dir == dp->inum && namecmp(name, d->name) == 0){
+      dunlink(d);
+      e = d->retired = rcuretire();
+      break;
+    }
+  }
+  release(&dcache.lock);
+  if(e)
+    rcuwait(e);
+}
+
+// Forget every entry in or for inode inum, which iput() is
+// freeing, so that they don't turn up in whatever reuses inum:
+// a directory's "." and ".." entries outlive its unlink().
+void
+dcachepurge(uint dev, uint inum)
+{
+  struct dentry *d;
+  uint64 e;
+  int n = 0;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < &dcache.dentry[NDENTRY]; d++){
+    if(d->state == DLIVE && d->dev == dev && (d->dir == inum || d->inum == inum)){
+      dunlink(d);
+      n++;
+    }
+  }
+  if(n){
+    e = rcuretire();
+    for(d = dcache.dentry; d < &dcache.dentry[NDENTRY]; d++)
+      if(d->state == DRETIRED && d->retired == 0)
+        d->retired = e;
+  }
+  release(&dcache.lock);
+}
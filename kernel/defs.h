@@ -1,13 +1,19 @@
 struct buf;
 struct context;
+struct fdtable;
 struct file;
 struct inode;
+struct memstat;
+struct mm;
 struct pipe;
 struct proc;
+struct slab;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct tlbgather;
+struct trapframe;
 
 // bio.c
 void            binit(void);
@@ -16,20 +22,39 @@ void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             bshrink(int);
+void            breadahead(uint, uint, uint);
+struct buf*     bnew(uint, uint);
+void            bwritev(struct buf**, int);
 
 // console.c
 void            consoleinit(void);
 void            consoleintr(int);
 void            consputc(int);
 
+// dcache.c
+void            dcacheinit(void);
+uint            dcachelookup(uint, uint, char*);
+void            dcacheadd(struct inode*, char*, uint);
+void            dcacheremove(struct inode*, char*);
+void            dcachepurge(uint, uint);
+
 // exec.c
+struct mm*      execload(struct proc*, char*, char**, uint64, int*);
 int             kexec(char*, char**);
 
+// fdt.c
+void            fdtinit(void);
+
 // file.c
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
+struct fdtable* fdtalloc(void);
+struct fdtable* fdtcopy(struct fdtable*);
+struct fdtable* fdtdup(struct fdtable*);
+void            fdtclose(struct fdtable*);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
@@ -55,10 +80,21 @@ int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
 void            ireclaim(int);
 
+// ipi.c
+void            tlbflush(uint64, uint64, uint64);
+void            tlbflushreqs(void);
+void            tlbshootdown(uint64, uint64, uint64, uint64);
+void            ipiintr(void);
+void            ipiwake(int);
+void            ipikick(uint64);
+
 // kalloc.c
 void*           kalloc(void);
+void*           kalloctype(int);
+int             kmemplenty(void);
 void            kfree(void *);
 void            kinit(void);
+void            kmemstat(struct memstat*);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -81,15 +117,21 @@ void            printfinit(void);
 int             cpuid(void);
 void            kexit(int);
 int             kfork(void);
+int             kclone(uint64, uint64, uint64);
+int             kvfork(void);
+void            vforkdone(struct proc*);
+int             kspawn(char*, char**);
 int             growproc(int);
-void            proc_mapstacks(pagetable_t);
-pagetable_t     proc_pagetable(struct proc *);
-void            proc_freepagetable(pagetable_t, uint64);
+struct mm*      mmalloc(void);
+int             mmattach(struct mm*, struct trapframe*);
+void            mmput(struct mm*);
+void            mmdetach(struct proc*);
 int             kkill(int);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
+struct proc*    findproc(int);
 void            procinit(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
@@ -98,9 +140,15 @@ void            userinit(void);
 int             kwait(uint64);
 void            wakeup(void*);
 void            yield(void);
+int             schedtick(void);
+int             ksetpriority(int, int);
+int             ksetaffinity(int, uint64);
+int             kgetaffinity(int, uint64*);
+int             kmaxproc(int);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+int             procrss(int, uint64*);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -112,6 +160,20 @@ void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+void            lockdump(void);
+
+// slab.c
+void            slabinit(struct slab*, char*, uint);
+void*           slaballoc(struct slab*);
+void            slabfree(struct slab*, void*);
+
+// rcu.c
+void            rcu_read_lock(void);
+void            rcu_read_unlock(void);
+void            rcuquiesce(void);
+uint64          rcuretire(void);
+int             rcuelapsed(uint64);
+void            rcuwait(uint64);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
@@ -127,6 +189,15 @@ char*           safestrcpy(char*, const char*, int);
 int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
+void            copy_page(void*, const void*);
+void            clear_page(void*);
+uint32          checksum(const void*, uint);
+#ifdef RVV
+int             scalar_memcmp(const void*, const void*, uint);
+void            scalar_copy_page(void*, const void*);
+void            scalar_clear_page(void*);
+uint32          scalar_checksum(const void*, uint);
+#endif
 
 // syscall.c
 int            argint(int, int*);
@@ -137,11 +208,18 @@ int             fetchaddr(uint64, uint64*);
 void            syscall();
 
 // trap.c
-extern uint     ticks;
-void            trapinit(void);
 void            trapinithart(void);
-extern struct spinlock tickslock;
-void            prepare_return(void);
+void            usertrapret(void);
+
+// timer.c
+extern uint64   timebase;
+void            clockinit(void);
+int             clockintr(void);
+uint            uptime(void);
+uint64          uptimeus(void);
+uint64          ustotime(uint64);
+void            timerarm(int);
+int             sleepuntil(uint64);
 
 // uart.c
 void            uartinit(void);
@@ -154,24 +232,58 @@ int             uartgetc(void);
 void            kvminit(void);
 void            kvminithart(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
+void            kvmmapmega(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+void            uvmprefault(pagetable_t, uint64, uint64, int);
 void            uvmfree(pagetable_t, uint64);
-void            uvmunmap(pagetable_t, uint64, uint64, int);
+uint64          uvmunmap(pagetable_t, uint64, uint64, int);
+uint64          uvmunmaplive(struct mm*, uint64, uint64);
 void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+pagetable_t     kvmcreate(void);
+void            kvmfree(pagetable_t);
 int             ismapped(pagetable_t, uint64);
 uint64          vmfault(pagetable_t, uint64, int);
+int             memcharge(struct mm*, uint64);
+uint64          mappedfor(pagetable_t, uint64, int);
+uint64          uvmswitch(struct proc*);
+void            uvmflush(struct mm*, uint64, uint64);
+void            tlbgather(struct tlbgather*, struct mm*);
+void            tlbunmap(struct tlbgather*, uint64, void*);
+void            tlbfinish(struct tlbgather*);
+
+// vector.c
+void            vecinit(void);
+int             vecfault(struct proc*);
+void            vecswitch(struct proc*);
+void            vecreturn(struct proc*);
+int             veccopy(struct proc*, struct proc*);
+void            vecfree(struct proc*);
+void            vecbench(void);
+
+// uaccess.S
+uint64          copy_user(char*, char*, uint64);
+long            strncpy_user(char*, char*, uint64);
+
+// mmap.c
 uint64          do_mmap(uint64, uint64, int, int, int, uint64);
 int             do_munmap(uint64, uint64);
-int             handle_mmap_fault(uint64);
+uint64          mmapfault(struct mm*, uint64, int);
+uint64          mmapbase(struct mm*);
+uint64          mmapreclaim(struct mm*, uint64);
+void            mmapfree(struct mm*);
+
+// futex.c
+void            futexinit(void);
+int             futex(uint64, int, int, uint64);
 
 // plic.c
 void            plicinit(void);
@@ -182,12 +294,10 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_start(struct buf *, int);
+void            virtio_disk_startv(struct buf **, int, int);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
-// vm.c
-void            uvmclear(pagetable_t, uint64);
-int             uvmcopy(pagetable_t, pagetable_t, uint64);
-void            prepare_return(void);
-
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
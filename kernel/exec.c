@@ -45,10 +45,15 @@ flags2perm(int flags)
 }
 
 //
-// the implementation of the exec() system call
+// Load the program in path into a new address space for p,
+// with p's trapframe mapped in a thread slot, and set the
+// trapframe up to start it with arguments argv. p is the
+// caller, for exec(), or a child that has yet to run, for
+// spawn(). Returns the address space, with the slot in *slot,
+// or 0, leaving p as it was.
 //
-int
-kexec(char *path, char **argv)
+struct mm*
+execload(struct proc *p, char *path, char **argv, uint64 memlimit, int *slot)
 {
   char *s, *last;
   int i, off;
@@ -56,15 +61,15 @@ kexec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
+  pagetable_t pagetable;
+  struct mm *mm = 0;
 
   begin_op();
 
   // Open the executable file.
   if((ip = namei(path)) == 0){
     end_op();
-    return -1;
+    return 0;
   }
   ilock(ip);
 
@@ -76,8 +81,14 @@ kexec(char *path, char **argv)
   if(elf.magic != ELF_MAGIC)
     goto bad;
 
-  if((pagetable = proc_pagetable(p)) == 0)
+  // a new address space, with p's trapframe mapped in it. other
+  // threads of p, if any, keep the old one.
+  if((mm = mmalloc()) == 0)
+    goto bad;
+  if((*slot = mmattach(mm, p->trapframe)) < 0)
     goto bad;
+  mm->memlimit = memlimit;
+  pagetable = mm->pagetable;
 
   // Load program into memory.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
@@ -102,29 +113,6 @@ kexec(char *path, char **argv)
   end_op();
   ip = 0;
 
-  p = myproc();
-  uint64 oldsz = p->sz;
-
-  // Clean up all mmap areas before loading new program.
-  // Use do_munmap (which centralizes unmap + writeback/close) if available;
-  // fallback to uvmunmap if do_munmap isn't implemented.
-  for(int i = 0; i < MAX_MMAP_AREAS; i++) {
-    if(p->mmap_areas[i].used) {
-      struct mmap_area *m = &p->mmap_areas[i];
-      // prefer do_munmap to ensure write-back semantics are honored
-      if (do_munmap(m->va_start, m->length) < 0) {
-        // if do_munmap for some reason fails, try uvmunmap to at least free pages
-        int npages = m->length / PGSIZE;
-        uvmunmap(p->pagetable, m->va_start, npages, 1);
-        if (m->f) fileclose(m->f);
-        m->used = 0;
-      }
-      // do_munmap should close the file and mark used=0; ensure state cleared
-      m->used = 0;
-    }
-  }
-  p->mmap_hint = 0;
-
   // Allocate some pages at the next page boundary.
   // Make the first inaccessible as a stack guard.
   // Use the rest as the user stack.
@@ -143,6 +131,8 @@ kexec(char *path, char **argv)
   if((sz1 = uvmalloc(pagetable, sz, sz + (USERSTACK+1)*PGSIZE, stackperm)) == 0)
     goto bad;
   sz = sz1;
+  if(mm->memlimit && sz / PGSIZE > mm->memlimit)
+    goto bad;
   uvmclear(pagetable, sz-(USERSTACK+1)*PGSIZE);
   sp = sz;
   stackbase = sp - USERSTACK*PGSIZE;
@@ -171,8 +161,7 @@ kexec(char *path, char **argv)
     goto bad;
 
   // a0 and a1 contain arguments to user main(argc, argv)
-  // argc is returned via the system call return
-  // value, which goes in a0.
+  p->trapframe->a0 = argc;
   p->trapframe->a1 = sp;
 
   // Save program name for debugging.
@@ -180,25 +169,48 @@ kexec(char *path, char **argv)
     if(*s == '/')
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
-    
-  // Commit to the user image.
-  oldpagetable = p->pagetable;
-  p->pagetable = pagetable;
-  p->sz = sz;
+
+  mm->sz = sz;
+  mm->rss = sz / PGSIZE - 1; // every page but the stack guard
   p->trapframe->epc = elf.entry;  // initial program counter = ulib.c:start()
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
-
-  return argc; // this ends up in a0, the first argument to main(argc, argv)
+  return mm;
 
  bad:
-  if(pagetable)
-    proc_freepagetable(pagetable, sz);
+  if(mm){
+    mm->sz = sz;
+    mmput(mm);
+  }
   if(ip){
     iunlockput(ip);
     end_op();
   }
-  return -1;
+  return 0;
+}
+
+//
+// the implementation of the exec() system call
+//
+int
+kexec(char *path, char **argv)
+{
+  struct proc *p = myproc();
+  struct mm *mm;
+  int slot;
+
+  if((mm = execload(p, path, argv, p->mm->memlimit, &slot)) == 0)
+    return -1;
+
+  // Commit to the user image.
+  mmdetach(p);    // frees the old image, if no other thread uses it
+  p->mm = mm;
+  p->tslot = slot;
+  vecfree(p);     // the new program starts with V off
+  vforkdone(p);   // a vfork() parent has its memory back
+
+  // argc is returned via the system call return
+  // value, which goes in a0.
+  return p->trapframe->a0;
 }
 
 // Load an ELF program segment into pagetable at virtual address va.
@@ -0,0 +1,184 @@
+//
+// Flattened device tree (DTB) parsing.
+//
+// qemu passes the physical address of a DTB describing the
+// machine to _entry in a1; start() saves it in dtb_pa.
+// fdtinit() walks the tree once, early in main() and before
+// paging is on, to learn how much RAM there is and where the
+// devices are, and how fast the time CSR counts. it must run
+// before kinit(), since the DTB sits in RAM that the page
+// allocator will hand out.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define FDT_MAGIC       0xd00dfeed
+#define FDT_BEGIN_NODE  1
+#define FDT_END_NODE    2
+#define FDT_PROP        3
+#define FDT_NOP         4
+#define FDT_END         9
+
+#define FDT_MAXDEPTH    16
+
+// all fields are big-endian.
+struct fdt_header {
+  uint32 magic;
+  uint32 totalsize;
+  uint32 off_dt_struct;
+  uint32 off_dt_strings;
+  uint32 off_mem_rsvmap;
+  uint32 version;
+  uint32 last_comp_version;
+  uint32 boot_cpuid_phys;
+  uint32 size_dt_strings;
+  uint32 size_dt_struct;
+};
+
+extern uint64 dtb_pa;   // start.c
+
+uint64 phystop = PHYSTOP_DEFAULT;
+struct fdtinfo fdtinfo;
+
+static uint32
+be32(void *a)
+{
+  uchar *b = a;
+  return ((uint32)b[0] << 24) | ((uint32)b[1] << 16) | ((uint32)b[2] << 8) | b[3];
+}
+
+// read a number that is ncells 32-bit cells long.
+static uint64
+cells(uchar *a, int ncells)
+{
+  uint64 v = 0;
+  for(int i = 0; i < ncells; i++)
+    v = (v << 32) | be32(a + 4*i);
+  return v;
+}
+
+static int
+streq(char *a, char *b)
+{
+  return strncmp(a, b, strlen(b) + 1) == 0;
+}
+
+// does node name (e.g. "memory@80000000") have base name s?
+static int
+isnode(char *name, char *s)
+{
+  int n = strlen(s);
+  return strncmp(name, s, n) == 0 && (name[n] == '@' || name[n] == '\0');
+}
+
+// record the first reg address of a device node.
+static void
+regnode(char *name, uint64 addr, uint64 size)
+{
+  if(isnode(name, "memory")){
+    // xv6 only knows how to use RAM that starts at KERNBASE.
+    if(addr == KERNBASE && fdtinfo.memsize == 0)
+      fdtinfo.memsize = size;
+  } else if(isnode(name, "serial") || isnode(name, "uart")){
+    if(fdtinfo.uart0 == 0)
+      fdtinfo.uart0 = addr;
+  } else if(isnode(name, "virtio_mmio")){
+    if(fdtinfo.virtio0 == 0 || addr < fdtinfo.virtio0)
+      fdtinfo.virtio0 = addr;
+  } else if(isnode(name, "plic") || isnode(name, "interrupt-controller")){
+    fdtinfo.plic = addr;
+  } else if(isnode(name, "clint")){
+    fdtinfo.clint = addr;
+  }
+}
+
+void
+fdtinit(void)
+{
+  struct fdt_header *h = (struct fdt_header *)dtb_pa;
+  char *names[FDT_MAXDEPTH];
+  int acells[FDT_MAXDEPTH], scells[FDT_MAXDEPTH];
+  int depth = 0;
+
+  if(h == 0 || be32(&h->magic) != FDT_MAGIC){
+    printf("fdt: no device tree, using %d MB\n",
+           (int)((PHYSTOP_DEFAULT - KERNBASE) >> 20));
+    return;
+  }
+
+  uchar *p = (uchar *)h + be32(&h->off_dt_struct);
+  char *strings = (char *)h + be32(&h->off_dt_strings);
+
+  // defaults from the devicetree spec, for the root's children.
+  acells[0] = 2;
+  scells[0] = 1;
+  names[0] = "";
+
+  for(;;){
+    uint32 tok = be32(p);
+    p += 4;
+    if(tok == FDT_BEGIN_NODE){
+      char *name = (char *)p;
+      p += (strlen(name) + 1 + 3) & ~3;
+      if(++depth >= FDT_MAXDEPTH)
+        panic("fdt: too deep");
+      names[depth] = name;
+      acells[depth] = 2;
+      scells[depth] = 1;
+      if(depth == 2 && isnode(names[1], "cpus") && isnode(name, "cpu"))
+        fdtinfo.ncpu++;
+    } else if(tok == FDT_END_NODE){
+      if(--depth < 0)
+        panic("fdt: unbalanced");
+    } else if(tok == FDT_PROP){
+      uint32 len = be32(p);
+      char *pname = strings + be32(p + 4);
+      uchar *val = p + 8;
+      p += 8 + ((len + 3) & ~3);
+      if(streq(pname, "#address-cells")){
+        acells[depth] = be32(val);
+      } else if(streq(pname, "#size-cells")){
+        scells[depth] = be32(val);
+      } else if(streq(pname, "timebase-frequency") && depth == 1 &&
+                isnode(names[1], "cpus") && len == 4){
+        timebase = be32(val);
+      } else if(streq(pname, "reg") && depth > 0){
+        // a node's reg is sized by its parent's cells.
+        int ac = acells[depth-1], sc = scells[depth-1];
+        if(len >= 4 * (ac + sc))
+          regnode(names[depth], cells(val, ac), cells(val + 4*ac, sc));
+      }
+    } else if(tok == FDT_NOP){
+      continue;
+    } else if(tok == FDT_END){
+      break;
+    } else {
+      panic("fdt: bad token");
+    }
+  }
+
+  if(fdtinfo.memsize != 0){
+    uint64 top = KERNBASE + fdtinfo.memsize;
+    // leave room for the kernel stacks and trampoline at the
+    // top of the kernel's virtual address space.
+    if(top > KSTACK(NPROCMAX))
+      top = KSTACK(NPROCMAX);
+    phystop = PGROUNDDOWN(top);
+  }
+
+  printf("fdt: %d MB RAM, %d cpus\n",
+         (int)((phystop - KERNBASE) >> 20), fdtinfo.ncpu);
+  if(fdtinfo.uart0 && fdtinfo.uart0 != UART0)
+    printf("fdt: warning: uart0 at %p, kernel uses %p\n",
+           (void *)fdtinfo.uart0, (void *)UART0);
+  if(fdtinfo.virtio0 && fdtinfo.virtio0 != VIRTIO0)
+    printf("fdt: warning: virtio0 at %p, kernel uses %p\n",
+           (void *)fdtinfo.virtio0, (void *)VIRTIO0);
+  if(fdtinfo.plic && fdtinfo.plic != PLIC)
+    printf("fdt: warning: plic at %p, kernel uses %p\n",
+           (void *)fdtinfo.plic, (void *)PLIC);
+}
@@ -12,6 +12,7 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "slab.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -19,10 +20,79 @@ struct {
   struct file file[NFILE];
 } ftable;
 
+// open-file tables, each shared by the threads of a process.
+static struct slab fdtslab;
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  slabinit(&fdtslab, "fdtslab", sizeof(struct fdtable));
+}
+
+// Allocate an empty open-file table.
+struct fdtable*
+fdtalloc(void)
+{
+  struct fdtable *fdt;
+
+  if((fdt = slaballoc(&fdtslab)) == 0)
+    return 0;
+  initlock(&fdt->lock, "fdtable");
+  fdt->ref = 1;
+  return fdt;
+}
+
+// A new table with the same open files as fdt, for fork().
+struct fdtable*
+fdtcopy(struct fdtable *fdt)
+{
+  struct fdtable *nfdt;
+
+  if((nfdt = fdtalloc()) == 0)
+    return 0;
+  acquire(&fdt->lock);
+  for(int fd = 0; fd < NOFILE; fd++)
+    if(fdt->ofile[fd])
+      nfdt->ofile[fd] = filedup(fdt->ofile[fd]);
+  release(&fdt->lock);
+  return nfdt;
+}
+
+// Increment ref count for table fdt, for clone().
+struct fdtable*
+fdtdup(struct fdtable *fdt)
+{
+  acquire(&fdt->lock);
+  if(fdt->ref < 1)
+    panic("fdtdup");
+  fdt->ref++;
+  release(&fdt->lock);
+  return fdt;
+}
+
+// Drop a reference to fdt, closing its files with the last.
+void
+fdtclose(struct fdtable *fdt)
+{
+  acquire(&fdt->lock);
+  if(fdt->ref < 1)
+    panic("fdtclose");
+  if(fdt->ref > 1){
+    fdt->ref--;
+    release(&fdt->lock);
+    return;
+  }
+  release(&fdt->lock);
+
+  // no other thread can reach fdt now.
+  for(int fd = 0; fd < NOFILE; fd++){
+    if(fdt->ofile[fd]){
+      fileclose(fdt->ofile[fd]);
+      fdt->ofile[fd] = 0;
+    }
+  }
+  slabfree(&fdtslab, fdt);
 }
 
 // Allocate a file structure.
@@ -94,7 +164,7 @@ filestat(struct file *f, uint64 addr)
     ilock(f->ip);
     stati(f->ip, &st);
     iunlock(f->ip);
-    if(copyout(p->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    if(copyout(p->mm->pagetable, addr, (char *)&st, sizeof(st)) < 0)
       return -1;
     return 0;
   }
@@ -118,6 +188,7 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
+    uvmprefault(myproc()->mm->pagetable, addr, n, 1);
     ilock(f->ip);
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
@@ -152,6 +223,7 @@ filewrite(struct file *f, uint64 addr, int n)
     // and 2 blocks of slop for non-aligned writes.
     int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
     int i = 0;
+    uvmprefault(myproc()->mm->pagetable, addr, n, 0);
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
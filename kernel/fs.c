@@ -22,6 +22,9 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+
+// file blocks readi() asks the disk for beyond those it reads.
+#define NREADAHEAD 4
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -188,6 +191,7 @@ iinit()
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
   }
+  dcacheinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -352,6 +356,7 @@ iput(struct inode *ip)
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
+    dcachepurge(ip->dev, ip->inum);
 
     releasesleep(&ip->lock);
 
@@ -502,6 +507,31 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  // have the disk fetch the file's blocks for this read and
+  // the next few together, a run of consecutive blocks per
+  // request, rather than one by one below.
+  if(ip->type == T_FILE && n > 0){
+    uint last = (off + n - 1) / BSIZE + NREADAHEAD;
+    uint start = 0, len = 0;
+    if(last > (ip->size - 1) / BSIZE)
+      last = (ip->size - 1) / BSIZE;
+    for(uint bn = off / BSIZE; bn <= last; bn++){
+      uint addr = bmap(ip, bn);
+      if(addr == 0)
+        break;
+      if(len > 0 && addr == start + len){
+        len++;
+        continue;
+      }
+      if(len > 0)
+        breadahead(ip->dev, start, len);
+      start = addr;
+      len = 1;
+    }
+    if(len > 0)
+      breadahead(ip->dev, start, len);
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
@@ -667,10 +697,47 @@ skipelem(char *path, char *name)
   return path;
 }
 
+// Walk the leading elements of path that the directory entry
+// cache knows, from directory ip, locking no inode. Returns
+// the inode reached, referenced, and advances *pathp past the
+// elements used; ip's reference is dropped if it moves on. with
+// nameiparent, stops before the last element, so that namex()
+// checks that the parent is a directory.
+static struct inode*
+namecached(struct inode *ip, char **pathp, int nameiparent)
+{
+  char name[DIRSIZ], *path = *pathp, *next;
+  uint inum = ip->inum, n;
+  struct inode *nip;
+
+  rcu_read_lock();
+  while((next = skipelem(path, name)) != 0){
+    if(nameiparent && *next == '\0')
+      break;
+    if((n = dcachelookup(ip->dev, inum, name)) == 0)
+      break;
+    inum = n;
+    path = next;
+  }
+  if(path == *pathp){
+    rcu_read_unlock();
+    return ip;
+  }
+  // take the reference before leaving the read-side section,
+  // so that an unlink() cannot free the inode first.
+  nip = iget(ip->dev, inum);
+  rcu_read_unlock();
+  *pathp = path;
+  iput(ip);
+  return nip;
+}
+
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
 // Must be called inside a transaction since it calls iput().
+// Locks only the directories below the part of the path the
+// directory entry cache knows, and caches what it finds there.
 static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
@@ -680,6 +747,7 @@ namex(char *path, int nameiparent, char *name)
     ip = iget(ROOTDEV, ROOTINO);
   else
     ip = idup(myproc()->cwd);
+  ip = namecached(ip, &path, nameiparent);
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
@@ -696,6 +764,7 @@ namex(char *path, int nameiparent, char *name)
       iunlockput(ip);
       return 0;
     }
+    dcacheadd(ip, name, next->inum);
     iunlockput(ip);
     ip = next;
   }
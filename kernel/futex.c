@@ -0,0 +1,259 @@
+//
+// Futexes: sleeping and waking on a word of user memory, so
+// that user-space locks need the kernel only when contended.
+//
+// a waiter is keyed by its address space and the user address
+// it waits on, and sits in the hash bucket for that key. a
+// waiter's struct futexwaiter lives on its own kernel stack;
+// the bucket's lock guards it, and wakers set woken under that
+// lock. FUTEX_REQUEUE moves waiters between buckets holding
+// both locks, so a waiter that wakes finds its bucket through
+// w->b, which it may read under either.
+//
+// keys are private to an address space: threads made by
+// clone() share futexes, separate processes do not, even
+// through a MAP_SHARED mapping.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "futex.h"
+#include "defs.h"
+
+#define NFUTEXBUCKET 64
+
+struct futexwaiter {
+  struct mm *mm;
+  uint64 addr;
+  int woken;
+  struct futexbucket *b;      // the bucket it is on
+  struct futexwaiter *next;
+};
+
+struct futexbucket {
+  struct spinlock lock;
+  struct futexwaiter *head;
+};
+
+static struct futexbucket buckets[NFUTEXBUCKET];
+
+void
+futexinit(void)
+{
+  for(int i = 0; i < NFUTEXBUCKET; i++)
+    initlock(&buckets[i].lock, "futex");
+}
+
+static struct futexbucket*
+futexbucket(struct mm *mm, uint64 addr)
+{
+  uint64 h = (addr >> 2) ^ ((uint64)mm >> 4);
+
+  h *= 0x9e3779b97f4a7c15ULL;
+  return &buckets[(h >> 32) % NFUTEXBUCKET];
+}
+
+static void
+enqueue(struct futexbucket *b, struct futexwaiter *w)
+{
+  w->b = b;
+  w->next = b->head;
+  b->head = w;
+}
+
+static void
+dequeue(struct futexbucket *b, struct futexwaiter *w)
+{
+  struct futexwaiter **pp;
+
+  for(pp = &b->head; *pp; pp = &(*pp)->next){
+    if(*pp == w){
+      *pp = w->next;
+      return;
+    }
+  }
+  panic("futex dequeue");
+}
+
+// Lock the bucket that waiter w is on, which FUTEX_REQUEUE
+// may change until we hold its lock.
+static struct futexbucket*
+lockwaiter(struct futexwaiter *w)
+{
+  struct futexbucket *b;
+
+  for(;;){
+    b = __atomic_load_n(&w->b, __ATOMIC_ACQUIRE);
+    acquire(&b->lock);
+    if(w->b == b)
+      return b;
+    release(&b->lock);
+  }
+}
+
+// Read the int at user address addr, if its page is mapped.
+// unlike copyin(), never faults, so it can run holding a
+// bucket lock. Returns -1 if the page is not mapped.
+static int
+futexread(struct mm *mm, uint64 addr, int *val)
+{
+  uint64 pa;
+
+  acquire(&mm->lock);
+  if((pa = mappedfor(mm->pagetable, PGROUNDDOWN(addr), 0)) == 0){
+    release(&mm->lock);
+    return -1;
+  }
+  *val = *(int*)(pa + (addr - PGROUNDDOWN(addr)));
+  release(&mm->lock);
+  return 0;
+}
+
+// Sleep until woken by FUTEX_WAKE, unless the int at addr
+// no longer holds val. the check and going to sleep are
+// atomic with respect to wakers.
+static int
+futexwait(struct mm *mm, uint64 addr, int val)
+{
+  struct proc *p = myproc();
+  struct futexwaiter w;
+  struct futexbucket *b;
+  int cur;
+
+  b = futexbucket(mm, addr);
+  for(;;){
+    acquire(&b->lock);
+    if(futexread(mm, addr, &cur) == 0)
+      break;
+    // fault the page in without the lock, and look again.
+    release(&b->lock);
+    if(vmfault(mm->pagetable, addr, 1) == 0)
+      return -1;
+  }
+  if(cur != val){
+    release(&b->lock);
+    return -1;
+  }
+
+  w.mm = mm;
+  w.addr = addr;
+  w.woken = 0;
+  enqueue(b, &w);
+  while(!w.woken){
+    if(killed(p)){
+      dequeue(b, &w);
+      release(&b->lock);
+      return -1;
+    }
+    sleep(&w, &b->lock);
+    if(w.b != b){
+      // requeued meanwhile.
+      release(&b->lock);
+      b = lockwaiter(&w);
+    }
+  }
+  release(&b->lock);
+  return 0;
+}
+
+// Wake up to n waiters on (mm, addr), in b, which the caller
+// has locked. Returns the number woken.
+static int
+wakeup_waiters(struct futexbucket *b, struct mm *mm, uint64 addr, int n)
+{
+  struct futexwaiter **pp, *w;
+  int woken = 0;
+
+  for(pp = &b->head; *pp && woken < n; ){
+    w = *pp;
+    if(w->mm != mm || w->addr != addr){
+      pp = &w->next;
+      continue;
+    }
+    *pp = w->next;
+    w->woken = 1;
+    wakeup(w);
+    woken++;
+  }
+  return woken;
+}
+
+static int
+futexwake(struct mm *mm, uint64 addr, int n)
+{
+  struct futexbucket *b = futexbucket(mm, addr);
+  int woken;
+
+  acquire(&b->lock);
+  woken = wakeup_waiters(b, mm, addr, n);
+  release(&b->lock);
+  return woken;
+}
+
+// Wake up to n waiters on addr and move the others to addr2,
+// so that a broadcast wakes one thread rather than a herd
+// that would all contend for the same lock.
+static int
+futexrequeue(struct mm *mm, uint64 addr, int n, uint64 addr2)
+{
+  struct futexbucket *b = futexbucket(mm, addr);
+  struct futexbucket *b2 = futexbucket(mm, addr2);
+  struct futexwaiter **pp, *w;
+  int woken;
+
+  // lock the two buckets in address order.
+  if(b < b2){
+    acquire(&b->lock);
+    acquire(&b2->lock);
+  } else {
+    acquire(&b2->lock);
+    if(b != b2)
+      acquire(&b->lock);
+  }
+
+  woken = wakeup_waiters(b, mm, addr, n);
+  for(pp = &b->head; *pp; ){
+    w = *pp;
+    if(w->mm != mm || w->addr != addr){
+      pp = &w->next;
+      continue;
+    }
+    w->addr = addr2;
+    if(b == b2){
+      pp = &w->next;
+      continue;
+    }
+    *pp = w->next;
+    enqueue(b2, w);
+  }
+
+  if(b != b2)
+    release(&b2->lock);
+  release(&b->lock);
+  return woken;
+}
+
+// The futex() system call, on the calling thread's address space.
+int
+futex(uint64 addr, int op, int val, uint64 addr2)
+{
+  struct mm *mm = myproc()->mm;
+
+  if(addr % sizeof(int) != 0 || addr >= USERTOP)
+    return -1;
+  switch(op){
+  case FUTEX_WAIT:
+    return futexwait(mm, addr, val);
+  case FUTEX_WAKE:
+    return futexwake(mm, addr, val);
+  case FUTEX_REQUEUE:
+    if(addr2 % sizeof(int) != 0 || addr2 >= USERTOP)
+      return -1;
+    return futexrequeue(mm, addr, val, addr2);
+  }
+  return -1;
+}
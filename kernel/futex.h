@@ -0,0 +1,4 @@
+// futex() operations.
+#define FUTEX_WAIT    0   // sleep if *addr == val
+#define FUTEX_WAKE    1   // wake up to val threads waiting on addr
+#define FUTEX_REQUEUE 2   // wake up to val, move the rest to addr2
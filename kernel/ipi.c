@@ -0,0 +1,129 @@
+//
+// Inter-processor interrupts, for flushing other harts' TLBs,
+// for waking idle harts to run a process, and for hurrying
+// RCU grace periods.
+//
+// a hart interrupts another by writing 1 to the target's CLINT
+// MSIP word. that raises a machine-mode software interrupt,
+// which machinevec in kernelvec.S passes on to supervisor mode
+// as a software interrupt; devintr() then calls ipiintr().
+//
+// tlbshootdown() describes its flush in the sending hart's
+// tlbreq, with a bit for each target in pending, interrupts
+// each target once, and spins until every target has flushed
+// and cleared its bit. a hart can wait for a shootdown with
+// interrupts off, in tlbshootdown() or acquire(), so both serve
+// requests while they spin; otherwise two harts shooting at
+// each other, or a target spinning on a lock the sender holds,
+// would deadlock.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+struct tlbreq {
+  uint64 asid;     // 0: flush everything
+  uint64 va;
+  uint64 npages;   // 0: all of asid and asid+1
+  uint64 pending;  // harts that have yet to flush
+};
+
+// one per sending hart, which has at most one shootdown
+// outstanding since it waits with interrupts off.
+struct tlbreq tlbreqs[NCPU];
+
+static void
+ipi_send(int hart)
+{
+  *(volatile uint32 *)CLINT_MSIP(hart) = 1;
+}
+
+// Flush this hart's TLB entries for npages from va, under
+// asid and asid+1 (see uvmswitch()).
+void
+tlbflush(uint64 asid, uint64 va, uint64 npages)
+{
+  if(asid == 0){
+    sfence_vma();
+  } else if(npages == 0){
+    sfence_vma_asid(asid);
+    sfence_vma_asid(asid + 1);
+  } else {
+    for(uint64 a = va; a < va + npages * PGSIZE; a += PGSIZE){
+      sfence_vma_page(a, asid);
+      sfence_vma_page(a, asid + 1);
+    }
+  }
+}
+
+// Carry out the flushes other harts have asked this one for.
+// Called with interrupts off.
+void
+tlbflushreqs(void)
+{
+  uint64 bit = 1L << cpuid();
+
+  for(int i = 0; i < NCPU; i++){
+    struct tlbreq *r = &tlbreqs[i];
+    if((*(volatile uint64 *)&r->pending & bit) == 0)
+      continue;
+    __sync_synchronize();
+    tlbflush(r->asid, r->va, r->npages);
+    __sync_fetch_and_and(&r->pending, ~bit);
+  }
+}
+
+// Have each hart in mask flush its TLB as tlbflush() would,
+// and wait until all have done so.
+void
+tlbshootdown(uint64 mask, uint64 asid, uint64 va, uint64 npages)
+{
+  struct tlbreq *r;
+
+  push_off();
+  r = &tlbreqs[cpuid()];
+  r->asid = asid;
+  r->va = va;
+  r->npages = npages;
+  __sync_synchronize();
+  r->pending = mask;
+  __sync_synchronize();
+  for(int i = 0; i < NCPU; i++)
+    if(mask & (1L << i))
+      ipi_send(i);
+  while(*(volatile uint64 *)&r->pending != 0)
+    tlbflushreqs();
+  pop_off();
+}
+
+// Wake hart from wfi in scheduler(), to look at the run queues.
+void
+ipiwake(int hart)
+{
+  ipi_send(hart);
+}
+
+// Interrupt each hart in mask, so that it notes an RCU
+// quiescent state (see rcu.c).
+void
+ipikick(uint64 mask)
+{
+  for(int i = 0; i < NCPU; i++)
+    if(mask & (1L << i))
+      ipi_send(i);
+}
+
+// a supervisor software interrupt: another hart's IPI. taking
+// an interrupt means the hart is not in an RCU read-side
+// section.
+void
+ipiintr(void)
+{
+  tlbflushreqs();
+  rcuquiesce();
+}
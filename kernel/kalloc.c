@@ -1,16 +1,22 @@
 // Physical memory allocator, for user processes,
-// kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// kernel stacks, page-table pages, pipe buffers,
+// and the buffer cache. Allocates whole 4096-byte pages.
+// Keeps counts of free and used pages, and of used
+// pages by purpose (see memstat.h).
 
 #include "types.h"
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "memstat.h"
 #include "defs.h"
 
 void freerange(void *pa_start, void *pa_end);
 
+// pages to take back from the buffer cache when out of memory.
+#define NRECLAIM 16
+
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
@@ -21,13 +27,27 @@ struct run {
 struct {
   struct spinlock lock;
   struct run *freelist;
+
+  // one byte per page of RAM from KERNBASE to PHYSTOP:
+  // 0 if the page is free, else 1 + its KMEM_* type.
+  uchar *type;
+  uint64 nfree;
+  uint64 total;
+  uint64 bytype[KMEM_NTYPE];
 } kmem;
 
 void
 kinit()
 {
+  uint64 npages = (PHYSTOP - KERNBASE) / PGSIZE;
+
   initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+
+  // the type array sits just after the kernel; its size
+  // depends on how much RAM fdtinit() found.
+  kmem.type = (uchar*)PGROUNDUP((uint64)end);
+  memset(kmem.type, 0, npages);
+  freerange(kmem.type + npages, (void*)PHYSTOP);
 }
 
 void
@@ -35,8 +55,10 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
     kfree(p);
+    kmem.total++;
+  }
 }
 
 // Free the page of physical memory pointed at by pa,
@@ -47,6 +69,7 @@ void
 kfree(void *pa)
 {
   struct run *r;
+  uint64 i;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
@@ -55,28 +78,71 @@ kfree(void *pa)
   memset(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
+  i = ((uint64)pa - KERNBASE) / PGSIZE;
 
   acquire(&kmem.lock);
+  if(kmem.type[i])
+    kmem.bytype[kmem.type[i] - 1]--;
+  kmem.type[i] = 0;
+  kmem.nfree++;
   r->next = kmem.freelist;
   kmem.freelist = r;
   release(&kmem.lock);
 }
 
-// Allocate one 4096-byte page of physical memory.
+// Allocate one 4096-byte page of physical memory,
+// and account for it as being used for type (KMEM_*).
 // Returns a pointer that the kernel can use.
-// Returns 0 if the memory cannot be allocated.
+// Returns 0 if the memory cannot be allocated, even after
+// shrinking the buffer cache.
 void *
-kalloc(void)
+kalloctype(int type)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  for(;;){
+    acquire(&kmem.lock);
+    r = kmem.freelist;
+    if(r){
+      kmem.freelist = r->next;
+      kmem.nfree--;
+      kmem.type[((uint64)r - KERNBASE) / PGSIZE] = type + 1;
+      kmem.bytype[type]++;
+    }
+    release(&kmem.lock);
+    if(r || bshrink(NRECLAIM) == 0)
+      break;
+  }
 
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
   return (void*)r;
 }
+
+// Allocate a page for a kernel object.
+void *
+kalloc(void)
+{
+  return kalloctype(KMEM_KERNEL);
+}
+
+// Is more than a quarter of memory free? the buffer cache
+// grows only while it is. a hint, read without the lock.
+int
+kmemplenty(void)
+{
+  return *(volatile uint64 *)&kmem.nfree > kmem.total / 4;
+}
+
+// Fill in the system-wide fields of *st.
+void
+kmemstat(struct memstat *st)
+{
+  acquire(&kmem.lock);
+  st->total = kmem.total;
+  st->free = kmem.nfree;
+  st->used = kmem.total - kmem.nfree;
+  for(int i = 0; i < KMEM_NTYPE; i++)
+    st->bytype[i] = kmem.bytype[i];
+  release(&kmem.lock);
+}
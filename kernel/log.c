@@ -28,7 +28,8 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are synchronous, but each writes its blocks in
+// few disk requests (see bwritev()).
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -62,24 +63,36 @@ initlog(int dev, struct superblock *sb)
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location,
+// MAXIOBLOCKS at a time, so that runs of consecutive home
+// blocks go to the disk in one request.
 static void
 install_trans(int recovering)
 {
-  int tail;
+  struct buf *dbufs[MAXIOBLOCKS];
+  int tail, i, n;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    if(recovering) {
-      printf("recovering tail %d dst %d\n", tail, log.lh.block[tail]);
+  if(recovering)
+    breadahead(log.dev, log.start+1, log.lh.n);
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if(n > MAXIOBLOCKS)
+      n = MAXIOBLOCKS;
+    for (i = 0; i < n; i++) {
+      if(recovering) {
+        printf("recovering tail %d dst %d\n", tail+i, log.lh.block[tail+i]);
+      }
+      struct buf *lbuf = bread(log.dev, log.start+tail+i+1); // read log block
+      dbufs[i] = bnew(log.dev, log.lh.block[tail+i]); // dst, overwritten whole
+      memmove(dbufs[i]->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    }
+    bwritev(dbufs, n);  // write dsts to disk
+    for (i = 0; i < n; i++) {
+      if(recovering == 0)
+        bunpin(dbufs[i]);
+      brelse(dbufs[i]);
     }
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
   }
 }
 
@@ -175,19 +188,28 @@ end_op(void)
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to log. the log's blocks
+// are consecutive, so each MAXIOBLOCKS of them are written in
+// one request.
 static void
 write_log(void)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  struct buf *to[MAXIOBLOCKS];
+  int tail, i, n;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if(n > MAXIOBLOCKS)
+      n = MAXIOBLOCKS;
+    for (i = 0; i < n; i++) {
+      to[i] = bnew(log.dev, log.start+tail+i+1); // log block
+      struct buf *from = bread(log.dev, log.lh.block[tail+i]); // cache block
+      memmove(to[i]->data, from->data, BSIZE);
+      brelse(from);
+    }
+    bwritev(to, n);  // write the log
+    for (i = 0; i < n; i++)
+      brelse(to[i]);
   }
 }
 
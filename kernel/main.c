@@ -16,17 +16,23 @@ main()
     printf("\n");
     printf("xv6 kernel is booting\n");
     printf("\n");
+    fdtinit();       // find RAM size in the device tree
     kinit();         // physical page allocator
+    vecinit();       // vector unit, with RVV
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
+#ifdef VECBENCH
+    vecbench();      // time the vector routines
+#endif
     procinit();      // process table
-    trapinit();      // trap vectors
+    clockinit();     // timers and sleep deadlines
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
+    futexinit();     // futex wait queues
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
@@ -1,3 +1,5 @@
+#ifndef MEMLAYOUT_H
+#define MEMLAYOUT_H
 // Physical memory layout
 
 // qemu -machine virt is set up like this,
@@ -17,6 +19,11 @@
 // end -- start of kernel page allocation area
 // PHYSTOP -- end RAM used by the kernel
 
+// core local interruptor (CLINT); writing 1 to a hart's MSIP
+// word raises a machine software interrupt on it (see ipi.c).
+#define CLINT 0x2000000L
+#define CLINT_MSIP(hart) (CLINT + 4*(hart))
+
 // qemu puts UART registers here in physical memory.
 #define UART0 0x10000000L
 #define UART0_IRQ 10
@@ -36,15 +43,32 @@
 // the kernel expects there to be RAM
 // for use by the kernel and user pages
 // from physical address 0x80000000 to PHYSTOP.
+// fdtinit() sets PHYSTOP from the device tree's
+// memory node; PHYSTOP_DEFAULT is used if there is none.
 #define KERNBASE 0x80000000L
-#define PHYSTOP (KERNBASE + 128*1024*1024)
+#define PHYSTOP_DEFAULT (KERNBASE + 128*1024*1024)
+#ifndef __ASSEMBLER__
+extern uint64 phystop;
+
+// what fdtinit() learned from the device tree; zero if absent.
+struct fdtinfo {
+  uint64 memsize;   // bytes of RAM starting at KERNBASE
+  uint64 uart0;
+  uint64 virtio0;   // lowest virtio mmio slot
+  uint64 plic;
+  uint64 clint;
+  int ncpu;         // cpu nodes under /cpus
+};
+extern struct fdtinfo fdtinfo;
+#endif
+#define PHYSTOP phystop
 
 // map the trampoline page to the highest address,
 // in both user and kernel space.
 #define TRAMPOLINE (MAXVA - PGSIZE)
 
-// map kernel stacks beneath the trampoline,
-// each surrounded by invalid guard pages.
+// map kernel stacks beneath the trampoline, as procs are
+// made, each surrounded by invalid guard pages.
 #define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*PGSIZE)
 
 // User memory layout.
@@ -54,6 +78,13 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   USERTOP (end of user memory)
+//   trapframes of threads made by clone(), one page each
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define MAXTHREAD 16  // threads per address space
+#define THREADFRAME(i) (TRAPFRAME - (i)*PGSIZE)
+#define USERTOP THREADFRAME(MAXTHREAD - 1)
+
+#endif // MEMLAYOUT_H
@@ -0,0 +1,16 @@
+// Physical memory accounting, as reported by the memstat() system call.
+
+// what a page allocated by kalloc() is used for.
+#define KMEM_KERNEL  0   // kernel objects: stacks, trapframes, pipes, ...
+#define KMEM_PGTBL   1   // page-table pages
+#define KMEM_ANON    2   // user anonymous memory: text, data, heap, stack
+#define KMEM_FILE    3   // file-backed pages: mmap and the buffer cache
+#define KMEM_NTYPE   4
+
+struct memstat {
+  uint64 total;              // pages managed by the allocator
+  uint64 free;               // pages on the free list
+  uint64 used;               // pages handed out by kalloc()
+  uint64 bytype[KMEM_NTYPE]; // used pages, by KMEM_* purpose
+  uint64 rss;                // resident user pages of the process asked about
+};
@@ -1,26 +1,369 @@
-#include "types.h"
-#include "param.h"      // NCPU, NOFILE
-#include "memlayout.h"
-#include "riscv.h"
-#include "spinlock.h"   // struct spinlock
-#include "proc.h"
-#include "defs.h"
-
-// -------------------------------------------------------
-// Minimal placeholder implementation for mmap / munmap.
-// This allows the kernel to COMPILE & LINK successfully.
-// -------------------------------------------------------
-
-uint64
-do_mmap(uint64 addr, uint64 length, int prot, int flags, int fd, uint64 offset)
-{
-    // TODO: actual mmap logic
-    return 0;   // return mapped address (stub)
-}
-
-int
-do_munmap(uint64 addr, uint64 length)
-{
-    // TODO: actual unmap logic
-    return 0;   // success (stub)
-}
+//
+// File-backed memory mappings: mmap() and munmap().
+//
+// do_mmap() only records a struct mmap_area in the process;
+// pages are read in from the file by mmapfault() the first
+// time they are touched. MAP_SHARED writable pages that the
+// hardware has marked dirty (PTE_D) are written back to the
+// file when they are unmapped. Clean pages can be dropped at
+// any time, since the file still holds their contents;
+// mmapreclaim() does that when a process hits its memory limit.
+//
+// the mappings belong to the address space (struct mm), shared
+// by a process's threads; mm->lock guards them along with the
+// page table, but is not held while reading or writing files.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "memstat.h"
+#include "defs.h"
+#include "vm.h"
+
+// Find the mapping that contains va, or 0.
+struct mmap_area *
+find_mmap_area(struct mm *mm, uint64 va)
+{
+  for(int i = 0; i < MAX_MMAP_AREAS; i++){
+    struct mmap_area *m = &mm->mmap_areas[i];
+    if(m->used && va >= m->va_start && va < m->va_start + m->length)
+      return m;
+  }
+  return 0;
+}
+
+// Does [va, va+len) overlap any mapping of p?
+static int
+overlaps(struct mm *mm, uint64 va, uint64 len)
+{
+  for(int i = 0; i < MAX_MMAP_AREAS; i++){
+    struct mmap_area *m = &mm->mmap_areas[i];
+    if(m->used && va < m->va_start + m->length && m->va_start < va + len)
+      return 1;
+  }
+  return 0;
+}
+
+// The lowest address of any mapping of mm, or USERTOP if it
+// has none: the heap may grow up to here. Called with mm->lock
+// held.
+uint64
+mmapbase(struct mm *mm)
+{
+  uint64 base = USERTOP;
+
+  for(int i = 0; i < MAX_MMAP_AREAS; i++){
+    struct mmap_area *m = &mm->mmap_areas[i];
+    if(m->used && m->va_start < base)
+      base = m->va_start;
+  }
+  return base;
+}
+
+static struct mmap_area *
+alloc_mmap_area(struct mm *mm)
+{
+  for(int i = 0; i < MAX_MMAP_AREAS; i++)
+    if(mm->mmap_areas[i].used == 0)
+      return &mm->mmap_areas[i];
+  return 0;
+}
+
+uint64
+do_mmap(uint64 addr, uint64 length, int prot, int flags, int fd, uint64 offset)
+{
+  struct proc *p = myproc();
+  struct mm *mm = p->mm;
+  struct file *f;
+  struct mmap_area *m;
+  uint64 va;
+
+  if(length == 0 || length > USERTOP || offset % PGSIZE != 0)
+    return -1;
+  if(fd < 0 || fd >= NOFILE || (f = p->fdt->ofile[fd]) == 0 || f->type != FD_INODE)
+    return -1;
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0)
+    return -1;
+  if((prot & PROT_READ) && !f->readable)
+    return -1;
+  // writes to a shared mapping reach the file.
+  if((prot & PROT_WRITE) && (flags & MAP_SHARED) && !f->writable)
+    return -1;
+
+  length = PGROUNDUP(length);
+  acquire(&mm->lock);
+  if(addr != 0){
+    va = addr;
+    if(va % PGSIZE != 0 || va + length < va || va + length > USERTOP)
+      goto bad;
+  } else {
+    // place mappings top-down beneath the trapframes, but
+    // never below the heap.
+    uint64 hint = mm->mmap_hint ? mm->mmap_hint : USERTOP;
+    uint64 floor = PGROUNDUP(mm->sz);
+    if(hint < length || hint - length < floor)
+      goto bad;
+    va = hint - length;
+    while(va > floor && overlaps(mm, va, length))
+      va -= PGSIZE;
+  }
+  if(va < PGROUNDUP(mm->sz) || overlaps(mm, va, length))
+    goto bad;
+
+  if((m = alloc_mmap_area(mm)) == 0)
+    goto bad;
+  m->va_start = va;
+  m->length = length;
+  m->f = filedup(f);
+  m->file_offset = offset;
+  m->prot = prot;
+  m->flags = flags;
+  m->used = 1;
+  if(mm->mmap_hint == 0 || va < mm->mmap_hint)
+    mm->mmap_hint = va;
+  release(&mm->lock);
+  return va;
+
+bad:
+  release(&mm->lock);
+  return -1;
+}
+
+// Write a dirty MAP_SHARED page back to the file.
+static void
+writeback(struct mmap_area *m, uint64 va, uint64 pa)
+{
+  struct inode *ip = m->f->ip;
+  uint off = m->file_offset + (va - m->va_start);
+  uint n = PGSIZE;
+
+  begin_op();
+  ilock(ip);
+  // never grow the file; only pages it backs are written.
+  if(off < ip->size){
+    if(ip->size - off < n)
+      n = ip->size - off;
+    writei(ip, 0, pa, off, n);
+  }
+  iunlock(ip);
+  end_op();
+}
+
+// Write back the dirty pages of shared mapping m in
+// [va, va+len). the page table is walked under mm->lock, since
+// other threads may be faulting pages in, but each page is
+// written without it, since writing the file sleeps. a dirty
+// page stays put meanwhile: mm->unmapping keeps other threads
+// from unmapping it, and mmapreclaim() drops only clean pages.
+// Called without mm->lock.
+static void
+writeback_pages(struct mm *mm, struct mmap_area *m, uint64 va, uint64 len)
+{
+  uint64 pa;
+
+  if((m->flags & MAP_SHARED) == 0)
+    return;
+  for(uint64 a = va; a < va + len; a += PGSIZE){
+    pte_t *pte;
+    acquire(&mm->lock);
+    pte = walk(mm->pagetable, a, 0);
+    pa = 0;
+    if(pte && (*pte & PTE_V) && (*pte & PTE_D))
+      pa = PTE2PA(*pte);
+    release(&mm->lock);
+    if(pa)
+      writeback(m, a, pa);
+  }
+}
+
+// Unmap [addr, addr+length), which must lie in one mapping
+// and include either its start or its end.
+int
+do_munmap(uint64 addr, uint64 length)
+{
+  struct mm *mm = myproc()->mm;
+  struct mmap_area *m;
+  struct file *f = 0;
+
+  if(addr % PGSIZE != 0 || length == 0)
+    return -1;
+  length = PGROUNDUP(length);
+  acquire(&mm->lock);
+  // one unmap at a time, since writing back sleeps.
+  while(mm->unmapping)
+    sleep(&mm->unmapping, &mm->lock);
+  if((m = find_mmap_area(mm, addr)) == 0)
+    goto out;
+  if(addr + length > m->va_start + m->length)
+    goto out;
+  if(addr != m->va_start && addr + length != m->va_start + m->length)
+    goto out;   // would split the mapping in two
+
+  mm->unmapping = 1;
+  release(&mm->lock);
+  writeback_pages(mm, m, addr, length);
+  acquire(&mm->lock);
+  mm->unmapping = 0;
+
+  mm->rss -= uvmunmaplive(mm, addr, length / PGSIZE);
+  if(addr == m->va_start){
+    m->va_start += length;
+    m->file_offset += length;
+  }
+  m->length -= length;
+  if(m->length == 0){
+    f = m->f;
+    m->f = 0;
+    m->used = 0;
+  }
+  release(&mm->lock);
+  wakeup(&mm->unmapping);
+  if(f)
+    fileclose(f);
+  return 0;
+
+out:
+  release(&mm->lock);
+  return -1;
+}
+
+// Handle a fault at va in one of mm's mappings by reading the
+// page in from the file. Returns the physical address of the
+// new page, or 0 if va is not mapped or memory is short.
+uint64
+mmapfault(struct mm *mm, uint64 va, int write)
+{
+  struct mmap_area *m;
+  struct file *f;
+  char *mem;
+  uint64 pa;
+  uint off;
+  int perm;
+
+  va = PGROUNDDOWN(va);
+  acquire(&mm->lock);
+  if((m = find_mmap_area(mm, va)) == 0)
+    goto bad;
+  if(write && (m->prot & PROT_WRITE) == 0)
+    goto bad;
+  if(!write && (m->prot & (PROT_READ|PROT_WRITE)) == 0)
+    goto bad;
+  if((pa = mappedfor(mm->pagetable, va, write)) != 0){
+    release(&mm->lock);
+    return pa;   // another thread faulted it in
+  }
+  if(ismapped(mm->pagetable, va))
+    goto bad;
+  f = filedup(m->f);
+  off = m->file_offset + (va - m->va_start);
+  perm = PTE_U;
+  if(m->prot & PROT_READ)
+    perm |= PTE_R;
+  if(m->prot & PROT_WRITE)
+    perm |= PTE_R | PTE_W;
+  release(&mm->lock);
+
+  if((mem = kalloctype(KMEM_FILE)) == 0){
+    fileclose(f);
+    return 0;
+  }
+  clear_page(mem);
+  // a copy to or from user space inside readi() or writei() of
+  // this very file, whose pages fileread() and filewrite()
+  // fault in beforehand but mmapreclaim() may since have
+  // dropped. locking the inode again would deadlock.
+  if(holdingsleep(&f->ip->lock)){
+    fileclose(f);
+    kfree(mem);
+    return 0;
+  }
+  ilock(f->ip);
+  if(off < f->ip->size)
+    readi(f->ip, 0, (uint64)mem, off, PGSIZE);
+  iunlock(f->ip);
+  fileclose(f);
+
+  // the mapping may have changed while the file was read.
+  acquire(&mm->lock);
+  if((m = find_mmap_area(mm, va)) == 0 || m->f != f ||
+     ismapped(mm->pagetable, va) || memcharge(mm, 1) < 0 ||
+     mappages(mm->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    pa = mappedfor(mm->pagetable, va, write);
+    release(&mm->lock);
+    kfree(mem);
+    return pa;
+  }
+  mm->rss++;
+  release(&mm->lock);
+  return (uint64)mem;
+
+bad:
+  release(&mm->lock);
+  return 0;
+}
+
+// Drop up to npages clean file-backed pages of mm, which can
+// be read in again from the file. Recently used pages
+// (PTE_A set) get a second chance: the first pass only
+// clears their accessed bit. Returns the number freed.
+// Called with mm->lock held.
+uint64
+mmapreclaim(struct mm *mm, uint64 npages)
+{
+  struct tlbgather g;
+  uint64 n = 0;
+
+  tlbgather(&g, mm);
+  for(int pass = 0; pass < 2 && n < npages; pass++){
+    for(int i = 0; i < MAX_MMAP_AREAS && n < npages; i++){
+      struct mmap_area *m = &mm->mmap_areas[i];
+      if(!m->used)
+        continue;
+      for(uint64 a = m->va_start; a < m->va_start + m->length && n < npages; a += PGSIZE){
+        pte_t *pte = walk(mm->pagetable, a, 0);
+        if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_D))
+          continue;
+        if(pass == 0 && (*pte & PTE_A)){
+          // also drop cached entries, so that the hardware
+          // sets it again on the next access.
+          *pte &= ~PTE_A;
+          tlbunmap(&g, a, 0);
+          continue;
+        }
+        void *pa = (void*)PTE2PA(*pte);
+        *pte = 0;
+        tlbunmap(&g, a, pa);
+        n++;
+      }
+    }
+  }
+  tlbfinish(&g);
+  mm->rss -= n;
+  return n;
+}
+
+// Unmap every mapping of mm, which its last thread is done
+// with, writing back dirty shared pages.
+void
+mmapfree(struct mm *mm)
+{
+  for(int i = 0; i < MAX_MMAP_AREAS; i++){
+    struct mmap_area *m = &mm->mmap_areas[i];
+    if(m->used){
+      writeback_pages(mm, m, m->va_start, m->length);
+      mm->rss -= uvmunmaplive(mm, m->va_start, m->length / PGSIZE);
+      fileclose(m->f);
+      m->f = 0;
+      m->used = 0;
+    }
+  }
+  mm->mmap_hint = 0;
+}
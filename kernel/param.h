@@ -1,4 +1,5 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC        64  // default maximum number of processes; see maxproc()
+#define NPROCMAX   1024  // most processes maxproc() allows
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
@@ -8,8 +9,14 @@
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGBLOCKS    (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define MAXIOBLOCKS  16  // most blocks in one disk request
+#define NBUF         (LOGBLOCKS+MAXIOBLOCKS)  // static disk block cache: a full log and a request
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define USERSTACK    1     // user stack pages
+#define NICEMAX      19    // largest nice value
+#ifndef HZ
+#define HZ           10    // scheduler ticks per second; make HZ=n
+#endif
+#define TIMEBASE     10000000  // time CSR Hz, if the DTB doesn't say
 
@@ -4,21 +4,90 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "slab.h"
+#include "memstat.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// procs are made as needed, from procslab, and are never
+// freed: an exited proc goes on the free list for reuse, so
+// that findproc() and the schedulers may look at any proc
+// they have a pointer to. allprocs links every proc made.
+static struct slab procslab;
+struct proc *allprocs;
+
+// address spaces, each shared by the threads of a process.
+// a process uses one, or two briefly in exec().
+static struct slab mmslab;
 
 struct proc *initproc;
 
+#ifdef MLFQ
+// a multi-level feedback queue. a process starts at level 0,
+// whose time slice is a tick; using up the slice of its level
+// moves it down a level, where slices are twice as long, and
+// a scheduler takes the first process from the highest level.
+// every BOOSTTICKS ticks every process returns to the top, so
+// that none starves. a process with nice n never rises above
+// level n*NPRIO/(NICEMAX+1).
+#define NPRIO 3
+#define BOOSTTICKS 100
+#define SLICE(prio) (1 << (prio))
+#else
+// round robin: one level, a tick each.
+#define NPRIO 1
+#define SLICE(prio) 1
+#endif
+
+// queues of RUNNABLE processes for each hart, one per
+// priority level. a process is on a queue from when it becomes
+// RUNNABLE until a scheduler picks it.
+// lock order: p->lock, then a queue's lock.
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];
+  struct proc *tail[NPRIO];
+  int n;        // processes on all levels
+  uint boost;   // priority boosts done (MLFQ)
+} runqs[NCPU];
+
+// harts that have started scheduling, a bit each.
+uint64 onlinecpus;
+
+// sleeping processes, hashed by the channel they sleep on, so
+// that wakeup() looks only at those that might be on its own.
+// a process is on a queue from just before it sleeps until it
+// runs again. lock order: a condition lock, then a wait
+// queue's lock, then p->lock.
+#define NWAITQ 64
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+} waitqs[NWAITQ];
+
+// pid_lock guards nextpid, the pid hash table, the list
+// of UNUSED procs, so that allocproc() and findproc() need
+// not look at every proc, and the process counts and limit.
+// it may be acquired while holding a p->lock, but not the
+// other way around.
 int nextpid = 1;
 struct spinlock pid_lock;
+#define NPIDHASH 256
+struct proc *pidhash[NPIDHASH];
+struct proc *freeprocs;
+int nproc;             // procs in use
+int nprocmade;         // procs made, each with a kernel stack
+int maxproc = NPROC;   // most procs in use at once
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void setrunnable(struct proc *p);
+static void freepid(struct proc *p);
+static int baseprio(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
+extern pagetable_t kernel_pagetable; // vm.c
 
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
@@ -26,36 +95,60 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
-void
-proc_mapstacks(pagetable_t kpgtbl)
+// Make a new UNUSED proc and put it on the free list. its
+// kernel stack is a page mapped high in kernel_pagetable,
+// followed by an invalid guard page; every mm's kpagetable
+// shares the level-1 table that maps it, so it is visible
+// there too. Called with pid_lock held.
+static int
+newproc(void)
 {
   struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
+  char *pa;
+  uint64 va;
+
+  if(nprocmade == NPROCMAX)
+    return -1;
+  if((p = slaballoc(&procslab)) == 0)
+    return -1;
+  if((pa = kalloc()) == 0){
+    slabfree(&procslab, p);
+    return -1;
+  }
+  va = KSTACK(nprocmade);
+  if(mappages(kernel_pagetable, va, PGSIZE, (uint64)pa, PTE_R | PTE_W) != 0){
+    kfree(pa);
+    slabfree(&procslab, p);
+    return -1;
   }
+  // a hart may cache that a PTE is invalid; have them all
+  // forget, since the new proc may run on any of them.
+  sfence_vma();
+  tlbshootdown(onlinecpus & ~(1L << cpuid()), 0, 0, 0);
+
+  initlock(&p->lock, "proc");
+  p->state = UNUSED;
+  p->kstack = va;
+  p->allnext = allprocs;
+  allprocs = p;
+  p->pidnext = freeprocs;
+  freeprocs = p;
+  nprocmade++;
+  return 0;
 }
 
 // initialize the proc table.
 void
 procinit(void)
 {
-  struct proc *p;
-  
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-      p->state = UNUSED;
-      p->kstack = KSTACK((int) (p - proc));
-  }
+  slabinit(&procslab, "procslab", sizeof(struct proc));
+  slabinit(&mmslab, "mmslab", sizeof(struct mm));
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runqs[i].lock, "runq");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitqs[i].lock, "waitq");
 }
 
 // Must be called with interrupts disabled,
@@ -89,20 +182,53 @@ myproc(void)
   return p;
 }
 
-int
-allocpid()
+// Take p out of the pid hash table and put it on the free
+// list, for allocproc(). Caller must hold p->lock.
+static void
+freepid(struct proc *p)
 {
-  int pid;
-  
+  struct proc **pp;
+
   acquire(&pid_lock);
-  pid = nextpid;
-  nextpid = nextpid + 1;
+  if(p->pid != 0){
+    for(pp = &pidhash[p->pid % NPIDHASH]; *pp != p; pp = &(*pp)->pidnext)
+      ;
+    *pp = p->pidnext;
+  }
+  p->pid = 0;
+  p->pidnext = freeprocs;
+  freeprocs = p;
+  nproc--;
   release(&pid_lock);
+}
 
-  return pid;
+// Find the process with the given pid, and return it with
+// p->lock held, or 0 if there is none.
+struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  if(pid <= 0)
+    return 0;
+  acquire(&pid_lock);
+  for(p = pidhash[pid % NPIDHASH]; p; p = p->pidnext)
+    if(p->pid == pid)
+      break;
+  release(&pid_lock);
+  if(p == 0)
+    return 0;
+  // p may have been freed and reused since; pids are not.
+  acquire(&p->lock);
+  if(p->pid != pid || p->state == UNUSED){
+    release(&p->lock);
+    return 0;
+  }
+  return p;
 }
 
-// Look in the process table for an UNUSED proc.
+// Take an UNUSED proc from the free list, or make one if
+// there are fewer than maxproc in use.
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
 // If there are no free procs, or a memory allocation fails, return 0.
@@ -110,20 +236,35 @@ static struct proc*
 allocproc(void)
 {
   struct proc *p;
+  int pid;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
+  // take a free proc and give it a pid, so that findproc()
+  // can find it once it is USED.
+  acquire(&pid_lock);
+  if(nproc >= maxproc || (freeprocs == 0 && newproc() < 0)){
+    release(&pid_lock);
+    return 0;
   }
-  return 0;
+  p = freeprocs;
+  freeprocs = p->pidnext;
+  nproc++;
+  pid = nextpid++;
+  p->pidnext = pidhash[pid % NPIDHASH];
+  pidhash[pid % NPIDHASH] = p;
+  release(&pid_lock);
+
+  acquire(&p->lock);
+  if(p->state != UNUSED)
+    panic("allocproc");
 
-found:
-  p->pid = allocpid();
+  p->pid = pid;
   p->state = USED;
+  p->cpu = -1;
+  p->affinity = ~0UL;
+  p->nice = 0;
+  p->prio = 0;
+  p->used = 0;
+  p->boost = 0;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -131,20 +272,10 @@ found:
     release(&p->lock);
     return 0;
   }
-
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
-    freeproc(p);
-    release(&p->lock);
-    return 0;
-  }
-
-  // Initialize mmap areas
-  for(int i = 0; i < MAX_MMAP_AREAS; i++) {
-    p->mmap_areas[i].used = 0;
-  }
-  p->mmap_hint = 0;
+  // the caller gives it an address space and open files.
+  p->mm = 0;
+  p->tslot = -1;
+  p->fdt = 0;
 
   // Set up new context to start executing at forkret,
   // which returns to user space.
@@ -161,70 +292,143 @@ found:
 static void
 freeproc(struct proc *p)
 {
+  // kexit() has already let go of the address space and open
+  // files, unless p never ran.
+  if(p->fdt)
+    fdtclose(p->fdt);
+  p->fdt = 0;
+  if(p->mm)
+    mmdetach(p);
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
-  p->pagetable = 0;
-  p->sz = 0;
-  p->pid = 0;
+  vecfree(p);
   p->parent = 0;
+  p->children = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
   p->state = UNUSED;
-  // mmap areas should already be cleaned up in exit/exec
-  // but ensure they're cleared here too
-  for(int i = 0; i < MAX_MMAP_AREAS; i++) {
-    p->mmap_areas[i].used = 0;
-  }
-  p->mmap_hint = 0;
+  freepid(p);
 }
 
-// Create a user page table for a given process, with no user memory,
-// but with trampoline and trapframe pages.
-pagetable_t
-proc_pagetable(struct proc *p)
+// Allocate an address space with no user memory and no
+// threads: a user page table holding only the trampoline,
+// and the matching kernel page table for uaccess().
+// Returns 0 if memory is short.
+struct mm*
+mmalloc(void)
 {
-  pagetable_t pagetable;
+  struct mm *mm;
 
-  // An empty page table.
-  pagetable = uvmcreate();
-  if(pagetable == 0)
+  if((mm = slaballoc(&mmslab)) == 0)
     return 0;
-
+  initlock(&mm->lock, "mm");
+  mm->ref = 1;
+  mm->tslots = 0;
+  mm->sz = 0;
+  mm->rss = 0;
+  mm->memlimit = 0;
+  mm->asidgen = 0;  // an ASID is assigned when it first runs
+  mm->tlbstale = 0;
+  mm->unmapping = 0;
+  for(int i = 0; i < MAX_MMAP_AREAS; i++)
+    mm->mmap_areas[i].used = 0;
+  mm->mmap_hint = 0;
+  mm->kpagetable = 0;
+
+  if((mm->pagetable = uvmcreate()) == 0)
+    goto bad;
   // map the trampoline code (for system call return)
   // at the highest user virtual address.
   // only the supervisor uses it, on the way
   // to/from user space, so not PTE_U.
-  if(mappages(pagetable, TRAMPOLINE, PGSIZE,
+  if(mappages(mm->pagetable, TRAMPOLINE, PGSIZE,
               (uint64)trampoline, PTE_R | PTE_X) < 0){
-    uvmfree(pagetable, 0);
-    return 0;
+    uvmfree(mm->pagetable, 0);
+    mm->pagetable = 0;
+    goto bad;
   }
+  if((mm->kpagetable = kvmcreate()) == 0)
+    goto bad;
+  return mm;
 
-  // map the trapframe page just below the trampoline page, for
-  // trampoline.S.
-  if(mappages(pagetable, TRAPFRAME, PGSIZE,
-              (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
-    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-    uvmfree(pagetable, 0);
-    return 0;
+bad:
+  mmput(mm);
+  return 0;
+}
+
+// Map trapframe tf, for trampoline.S, in a free thread slot
+// of mm. Returns the slot, or -1.
+int
+mmattach(struct mm *mm, struct trapframe *tf)
+{
+  int slot;
+
+  acquire(&mm->lock);
+  for(slot = 0; slot < MAXTHREAD; slot++)
+    if((mm->tslots & (1L << slot)) == 0)
+      break;
+  if(slot == MAXTHREAD ||
+     mappages(mm->pagetable, THREADFRAME(slot), PGSIZE, (uint64)tf, PTE_R | PTE_W) < 0){
+    release(&mm->lock);
+    return -1;
   }
+  mm->tslots |= 1L << slot;
+  release(&mm->lock);
+  return slot;
+}
 
-  return pagetable;
+// Drop a reference to mm, freeing it and its user memory with
+// the last. Any threads' trapframes must be detached, or be
+// about to be freed with their procs.
+void
+mmput(struct mm *mm)
+{
+  acquire(&mm->lock);
+  if(mm->ref > 1){
+    mm->ref--;
+    release(&mm->lock);
+    return;
+  }
+  release(&mm->lock);
+
+  // no other thread can reach mm now.
+  mmapfree(mm);
+  if(mm->pagetable){
+    uvmunmap(mm->pagetable, TRAMPOLINE, 1, 0);
+    for(int slot = 0; slot < MAXTHREAD; slot++)
+      if(mm->tslots & (1L << slot))
+        uvmunmap(mm->pagetable, THREADFRAME(slot), 1, 0);
+    uvmfree(mm->pagetable, mm->sz);
+  }
+  mm->pagetable = 0;
+  if(mm->kpagetable)
+    kvmfree(mm->kpagetable);
+  mm->kpagetable = 0;
+  slabfree(&mmslab, mm);
 }
 
-// Free a process's page table, and free the
-// physical memory it refers to.
+// Let go of p's address space: unmap p's trapframe from it,
+// and drop p's reference.
 void
-proc_freepagetable(pagetable_t pagetable, uint64 sz)
+mmdetach(struct proc *p)
 {
-  uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-  uvmunmap(pagetable, TRAPFRAME, 1, 0);
-  uvmfree(pagetable, sz);
+  struct mm *mm = p->mm;
+
+  if(p->tslot >= 0){
+    acquire(&mm->lock);
+    uvmunmap(mm->pagetable, THREADFRAME(p->tslot), 1, 0);
+    mm->tslots &= ~(1L << p->tslot);
+    // other threads' TLBs must not keep the trapframe page,
+    // which freeproc() frees.
+    uvmflush(mm, THREADFRAME(p->tslot), 1);
+    release(&mm->lock);
+  }
+  p->mm = 0;
+  p->tslot = -1;
+  mmput(mm);
 }
 
 // Set up first user process.
@@ -235,35 +439,57 @@ userinit(void)
 
   p = allocproc();
   initproc = p;
+
+  // kexec() in forkret() replaces this empty address space.
+  if((p->mm = mmalloc()) == 0 || (p->tslot = mmattach(p->mm, p->trapframe)) < 0)
+    panic("userinit");
+  if((p->fdt = fdtalloc()) == 0)
+    panic("userinit");
   
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
+// the heap may not grow into an mmap() mapping; since every
+// mapping lies above sz, shrinking never reaches one.
 int
 growproc(int n)
 {
   uint64 sz;
-  struct proc *p = myproc();
+  struct mm *mm = myproc()->mm;
 
-  sz = p->sz;
+  acquire(&mm->lock);
+  sz = mm->sz;
   if(n > 0){
-    if(sz + n > TRAPFRAME) {
-      return -1;
+    if(PGROUNDUP(sz + n) > mmapbase(mm))
+      goto bad;
+    if(memcharge(mm, (PGROUNDUP(sz + n) - PGROUNDUP(sz)) / PGSIZE) < 0)
+      goto bad;
+    if((sz = uvmalloc(mm->pagetable, sz, sz + n, PTE_W)) == 0)
+      goto bad;
+    mm->rss += (PGROUNDUP(sz) - PGROUNDUP(mm->sz)) / PGSIZE;
+  } else if(n < 0 && sz + n < sz){
+    // like uvmdealloc(), but count the pages actually freed,
+    // since lazily allocated pages may never have been touched.
+    if(PGROUNDUP(sz + n) < PGROUNDUP(sz)){
+      uint64 va = PGROUNDUP(sz + n);
+      uint64 npages = (PGROUNDUP(sz) - va) / PGSIZE;
+      mm->rss -= uvmunmaplive(mm, va, npages);
     }
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
-      return -1;
-    }
-  } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    sz = sz + n;
   }
-  p->sz = sz;
+  mm->sz = sz;
+  release(&mm->lock);
   return 0;
+
+bad:
+  release(&mm->lock);
+  return -1;
 }
 
 // Create a new process, copying the parent.
@@ -271,22 +497,52 @@ growproc(int n)
 int
 kfork(void)
 {
-  int i, pid;
+  int i, pid, npages;
   struct proc *np;
   struct proc *p = myproc();
+  struct mm *mm = p->mm, *nmm;
 
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
   }
+  if((np->mm = mmalloc()) == 0 ||
+     (np->tslot = mmattach(np->mm, np->trapframe)) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  nmm = np->mm;
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  acquire(&mm->lock);
+  if((npages = uvmcopy(mm->pagetable, nmm->pagetable, mm->sz)) < 0){
+    release(&mm->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  nmm->sz = mm->sz;
+  // only the heap is copied; mapped file pages fault in anew.
+  nmm->rss = npages;
+  nmm->memlimit = mm->memlimit;
+
+  // Copy mmap areas (child inherits mappings, but pages remain lazy)
+  for(i = 0; i < MAX_MMAP_AREAS; i++) {
+    if(mm->mmap_areas[i].used) {
+      nmm->mmap_areas[i] = mm->mmap_areas[i];
+      // Increment file reference count
+      filedup(mm->mmap_areas[i].f);
+    }
+  }
+  nmm->mmap_hint = mm->mmap_hint;
+  release(&mm->lock);
+
+  if(veccopy(p, np) < 0 || (np->fdt = fdtcopy(p->fdt)) == 0){
     freeproc(np);
     release(&np->lock);
     return -1;
   }
-  np->sz = p->sz;
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -294,23 +550,70 @@ kfork(void)
   // Cause fork to return 0 in the child.
   np->trapframe->a0 = 0;
 
-  // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  np->nice = p->nice;
+  np->affinity = p->affinity;
+  np->prio = baseprio(np);
 
-  // Copy mmap areas (child inherits mappings, but pages remain lazy)
-  for(i = 0; i < MAX_MMAP_AREAS; i++) {
-    if(p->mmap_areas[i].used) {
-      np->mmap_areas[i] = p->mmap_areas[i];
-      // Increment file reference count
-      filedup(p->mmap_areas[i].f);
-    } else {
-      np->mmap_areas[i].used = 0;
-    }
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  np->parent = p;
+  np->sibling = p->children;
+  p->children = np;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  setrunnable(np);
+  release(&np->lock);
+
+  return pid;
+}
+
+// Create a thread: a new process that shares the caller's
+// address space and open files, and starts at fn(arg) on the
+// user stack whose top is stack. fn must not return, but call
+// exit(). Returns the new thread's pid, or -1.
+int
+kclone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int pid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct mm *mm = p->mm;
+
+  if(stack % 16 != 0)  // riscv sp must be 16-byte aligned
+    return -1;
+  if((np = allocproc()) == 0)
+    return -1;
+
+  acquire(&mm->lock);
+  mm->ref++;
+  release(&mm->lock);
+  np->mm = mm;
+  if((np->tslot = mmattach(mm, np->trapframe)) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
   }
-  np->mmap_hint = p->mmap_hint;
+  np->fdt = fdtdup(p->fdt);
+
+  // the caller's registers, except that the thread starts at fn.
+  // its vector registers start off, as after exec().
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->sp = stack;
+  np->trapframe->a0 = arg;
+  np->trapframe->ra = 0;
+
+  np->cwd = idup(p->cwd);
+  np->nice = p->nice;
+  np->affinity = p->affinity;
+  np->prio = baseprio(np);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -320,10 +623,146 @@ kfork(void)
 
   acquire(&wait_lock);
   np->parent = p;
+  np->sibling = p->children;
+  p->children = np;
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np);
+  release(&np->lock);
+
+  return pid;
+}
+
+// Create a process that borrows the caller's address space
+// until it calls exec() or exit(), as vfork() does: no memory
+// is copied, and the caller waits until then. the child
+// returns 0 on the caller's user stack, so it should do little
+// but exec() or exit(). it gets a copy of the caller's open
+// files, as after fork(), and its vector registers start off.
+// Returns the child's pid, or -1.
+int
+kvfork(void)
+{
+  int pid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct mm *mm = p->mm;
+
+  if((np = allocproc()) == 0)
+    return -1;
+
+  acquire(&mm->lock);
+  mm->ref++;
+  release(&mm->lock);
+  np->mm = mm;
+  if((np->tslot = mmattach(mm, np->trapframe)) < 0 ||
+     (np->fdt = fdtcopy(p->fdt)) == 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->a0 = 0;
+
+  np->cwd = idup(p->cwd);
+  np->nice = p->nice;
+  np->affinity = p->affinity;
+  np->prio = baseprio(np);
+  np->vfork = 1;
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  np->parent = p;
+  np->sibling = p->children;
+  p->children = np;
+
+  acquire(&np->lock);
+  setrunnable(np);
+  release(&np->lock);
+
+  // a killed caller stops waiting; the child holds its own
+  // reference to the address space.
+  while(np->vfork && !killed(p))
+    sleep(&np->vfork, &wait_lock);
+  release(&wait_lock);
+
+  return pid;
+}
+
+// Let p's parent, if it waits in vfork(), go on: p has let
+// go of the parent's address space, in exec() or exit().
+void
+vforkdone(struct proc *p)
+{
+  // only p clears p->vfork, and it was set before p ran.
+  if(p->vfork == 0)
+    return;
+  acquire(&wait_lock);
+  p->vfork = 0;
+  wakeup(&p->vfork);
+  release(&wait_lock);
+}
+
+// Create a process running the program in path with
+// arguments argv, loaded straight into a new address space,
+// so that the cost does not depend on the caller's size. the
+// child shares nothing with the caller, but starts with
+// copies of its open files and its working directory.
+// Returns the child's pid, or -1.
+int
+kspawn(char *path, char **argv)
+{
+  int pid, slot;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct mm *mm;
+
+  if((np = allocproc()) == 0)
+    return -1;
+
+  // loading the program sleeps. np is not RUNNABLE, so
+  // nothing else uses it meanwhile.
+  release(&np->lock);
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  mm = execload(np, path, argv, p->mm->memlimit, &slot);
+  acquire(&np->lock);
+  if(mm == 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->mm = mm;
+  np->tslot = slot;
+  if((np->fdt = fdtcopy(p->fdt)) == 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+
+  np->cwd = idup(p->cwd);
+  np->nice = p->nice;
+  np->affinity = p->affinity;
+  np->prio = baseprio(np);
+
+  pid = np->pid;
+
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  np->parent = p;
+  np->sibling = p->children;
+  p->children = np;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
@@ -336,12 +775,17 @@ reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+  if(p->children == 0)
+    return;
+  for(pp = p->children; ; pp = pp->sibling){
+    pp->parent = initproc;
+    if(pp->sibling == 0)
+      break;
   }
+  pp->sibling = initproc->children;
+  initproc->children = p->children;
+  p->children = 0;
+  wakeup(initproc);
 }
 
 // Exit the current process.  Does not return.
@@ -355,33 +799,14 @@ kexit(int status)
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
-  }
+  // Close all open files, unless other threads share them.
+  fdtclose(p->fdt);
+  p->fdt = 0;
 
-  // Clean up mmap areas
-  for(int i = 0; i < MAX_MMAP_AREAS; i++) {
-    if(p->mmap_areas[i].used) {
-      // Unmap all pages in this VMA
-      struct mmap_area *m = &p->mmap_areas[i];
-      for(uint64 a = m->va_start; a < m->va_start + m->length; a += PGSIZE) {
-        pte_t *pte = walk(p->pagetable, a, 0);
-        if(pte && (*pte & PTE_V)) {
-          uint64 pa = PTE2PA(*pte);
-          *pte = 0;
-          kfree((void*)pa);
-        }
-      }
-      // Close file reference
-      fileclose(m->f);
-      m->used = 0;
-    }
-  }
+  // Let go of the address space. the last thread to do so
+  // unmaps the mmap areas, writing back dirty shared pages.
+  mmdetach(p);
+  vforkdone(p);
 
   begin_op();
   iput(p->cwd);
@@ -413,41 +838,38 @@ kexit(int status)
 int
 kwait(uint64 addr)
 {
-  struct proc *pp;
-  int havekids, pid;
+  struct proc *pp, **ppp;
+  int pid;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&pp->lock);
-
-        havekids = 1;
-        if(pp->state == ZOMBIE){
-          // Found one.
-          pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(pp);
+    // Scan through the children looking for exited ones.
+    for(ppp = &p->children; (pp = *ppp) != 0; ppp = &pp->sibling){
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&pp->lock);
+
+      if(pp->state == ZOMBIE){
+        // Found one.
+        pid = pp->pid;
+        if(addr != 0 && copyout(p->mm->pagetable, addr, (char *)&pp->xstate,
+                                sizeof(pp->xstate)) < 0) {
           release(&pp->lock);
           release(&wait_lock);
-          return pid;
+          return -1;
         }
+        *ppp = pp->sibling;
+        freeproc(pp);
         release(&pp->lock);
+        release(&wait_lock);
+        return pid;
       }
+      release(&pp->lock);
     }
 
     // No point waiting if we don't have any children.
-    if(!havekids || killed(p)){
+    if(p->children == 0 || killed(p)){
       release(&wait_lock);
       return -1;
     }
@@ -457,6 +879,165 @@ kwait(uint64 addr)
   }
 }
 
+// The highest level p may run at, given its nice value.
+static int
+baseprio(struct proc *p)
+{
+  return p->nice * NPRIO / (NICEMAX + 1);
+}
+
+// The hart on whose queue p should wait: the one it last ran
+// on, whose caches may still hold its data, or else this one,
+// or else the first p may run on.
+static int
+runqfor(struct proc *p)
+{
+  uint64 ok = p->affinity & onlinecpus;
+
+  if(p->cpu >= 0 && (ok & (1L << p->cpu)))
+    return p->cpu;
+  if(ok == 0 || (ok & (1L << cpuid())))
+    return cpuid();   // ok == 0: still booting
+  for(int i = 0; i < NCPU; i++)
+    if(ok & (1L << i))
+      return i;
+  panic("runqfor");
+}
+
+// Make p RUNNABLE, and queue it where runqfor() says.
+// Caller must hold p->lock.
+static void
+setrunnable(struct proc *p)
+{
+  struct runq *rq;
+
+#ifdef MLFQ
+  if(p->boost != uptime() / BOOSTTICKS){
+    p->boost = uptime() / BOOSTTICKS;
+    p->prio = baseprio(p);
+    p->used = 0;
+  }
+#endif
+  p->cpu = runqfor(p);
+  p->state = RUNNABLE;
+  rq = &runqs[p->cpu];
+  acquire(&rq->lock);
+  p->rqnext = 0;
+  if(rq->tail[p->prio])
+    rq->tail[p->prio]->rqnext = p;
+  else
+    rq->head[p->prio] = p;
+  rq->tail[p->prio] = p;
+  rq->n++;
+  release(&rq->lock);
+
+  if(p->cpu == cpuid())
+    return;
+  // idle harts sleep in wfi until an interrupt. wake p's hart
+  // if it is idle, or else another idle hart to steal p.
+  // scheduler() sets c->idle before it looks at the queues,
+  // so one of the two sees the other.
+  __sync_synchronize();
+  if(cpus[p->cpu].idle){
+    ipiwake(p->cpu);
+    return;
+  }
+  for(int i = 0; i < NCPU; i++){
+    if(i != cpuid() && cpus[i].idle && (p->affinity & (1L << i))){
+      ipiwake(i);
+      return;
+    }
+  }
+}
+
+// Take the first process from rq's highest non-empty level
+// that may run on hart id.
+static struct proc*
+runqpop(struct runq *rq, int id)
+{
+  struct proc *p = 0, *prev, **pp;
+
+  acquire(&rq->lock);
+#ifdef MLFQ
+  if(rq->boost != uptime() / BOOSTTICKS){
+    // move each process up to the highest level its nice value
+    // allows; each resets its own p->prio when next queued.
+    // p->nice is read without p->lock, and a stale value only
+    // misplaces p until then.
+    struct proc *next;
+    int b;
+
+    rq->boost = uptime() / BOOSTTICKS;
+    for(int l = 1; l < NPRIO; l++){
+      p = rq->head[l];
+      rq->head[l] = rq->tail[l] = 0;
+      for(; p; p = next){
+        next = p->rqnext;
+        if((b = baseprio(p)) > l)
+          b = l;
+        p->rqnext = 0;
+        if(rq->tail[b])
+          rq->tail[b]->rqnext = p;
+        else
+          rq->head[b] = p;
+        rq->tail[b] = p;
+      }
+    }
+  }
+#endif
+  for(int l = 0; l < NPRIO; l++){
+    prev = 0;
+    for(pp = &rq->head[l]; (p = *pp) != 0; pp = &p->rqnext){
+      // p->lock guards affinity; a stale read is caught by
+      // scheduler().
+      if(p->affinity & (1L << id)){
+        *pp = p->rqnext;
+        if(rq->tail[l] == p)
+          rq->tail[l] = prev;
+        rq->n--;
+        goto out;
+      }
+      prev = p;
+    }
+  }
+out:
+  release(&rq->lock);
+  return p;
+}
+
+// Pick a process for hart id to run: the first on its own
+// queue or, if that is empty, one stolen from the longest
+// other queue that has one allowed to run here, failing which
+// from any other. the lengths are read without locks, as a hint.
+static struct proc*
+runqnext(int id)
+{
+  struct runq *busiest = 0;
+  struct proc *p;
+  int n, most = 0;
+
+  if((p = runqpop(&runqs[id], id)) != 0)
+    return p;
+  for(int i = 0; i < NCPU; i++){
+    n = __atomic_load_n(&runqs[i].n, __ATOMIC_RELAXED);
+    if(i != id && n > most){
+      busiest = &runqs[i];
+      most = n;
+    }
+  }
+  if(busiest == 0)
+    return 0;
+  if((p = runqpop(busiest, id)) != 0)
+    return p;
+  for(int i = 0; i < NCPU; i++){
+    if(i != id && &runqs[i] != busiest &&
+       __atomic_load_n(&runqs[i].n, __ATOMIC_RELAXED) > 0 &&
+       (p = runqpop(&runqs[i], id)) != 0)
+      return p;
+  }
+  return 0;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -469,8 +1050,10 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
 
   c->proc = 0;
+  __sync_fetch_and_or(&onlinecpus, 1L << id);
   for(;;){
     // The most recent process to run may have had interrupts
     // turned off; enable them to avoid a deadlock if all
@@ -480,28 +1063,38 @@ scheduler(void)
     intr_on();
     intr_off();
 
-    int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-        found = 1;
-      }
-      release(&p->lock);
-    }
-    if(found == 0) {
-      // nothing to run; stop running on this core until an interrupt.
+    // between processes, so in no RCU read-side section.
+    rcuquiesce();
+    c->idle = 1;
+    __sync_synchronize();
+    if((p = runqnext(id)) == 0) {
+      // nothing to run; stop running on this core until an
+      // interrupt, with no timer unless a sleeper needs waking.
+      timerarm(0);
       asm volatile("wfi");
+      continue;
     }
+    c->idle = 0;
+
+    acquire(&p->lock);
+    if(p->state == RUNNABLE && (p->affinity & (1L << id)) == 0) {
+      // its affinity changed while it was queued.
+      setrunnable(p);
+    } else if(p->state == RUNNABLE) {
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      p->state = RUNNING;
+      p->cpu = id;
+      c->proc = p;
+      timerarm(1);   // a full tick for p
+      swtch(&c->context, &p->context);
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      c->proc = 0;
+    }
+    release(&p->lock);
   }
 }
 
@@ -528,6 +1121,7 @@ sched(void)
     panic("sched interruptible");
 
   intena = mycpu()->intena;
+  vecswitch(p);
   swtch(&p->context, &mycpu()->context);
   mycpu()->intena = intena;
 }
@@ -538,17 +1132,121 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
 
+// Charge a timer tick to the running process. Returns 1 if it
+// should yield(): it has used up its time slice, which under
+// MLFQ also moves it down a level, or a process of a higher
+// level is waiting on this hart.
+int
+schedtick(void)
+{
+  struct proc *p = myproc();
+  int preempt = 0;
+
+  acquire(&p->lock);
+  if(++p->used >= SLICE(p->prio)){
+    p->used = 0;
+    if(p->prio < NPRIO - 1)
+      p->prio++;
+    preempt = 1;
+  }
+  for(int l = 0; l < p->prio && !preempt; l++)
+    if(__atomic_load_n(&runqs[cpuid()].head[l], __ATOMIC_RELAXED))
+      preempt = 1;
+  release(&p->lock);
+  return preempt;
+}
+
+// Set the harts that process pid, or the caller if pid is 0,
+// may run on. the mask is limited to harts that are running.
+// a process already running elsewhere moves the next time it
+// gives up its hart; the caller moves at once.
+int
+ksetaffinity(int pid, uint64 mask)
+{
+  struct proc *p;
+  int cpu;
+
+  mask &= onlinecpus;
+  if(mask == 0)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->affinity = mask;
+  cpu = p->cpu;
+  release(&p->lock);
+  if(p == myproc() && (mask & (1L << cpu)) == 0)
+    yield();
+  return 0;
+}
+
+// The harts process pid, or the caller if pid is 0, may run
+// on, in *mask. Returns 0, or -1 if there is no such process.
+int
+kgetaffinity(int pid, uint64 *mask)
+{
+  struct proc *p;
+
+  if(pid == 0)
+    pid = myproc()->pid;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  *mask = p->affinity & onlinecpus;
+  release(&p->lock);
+  return 0;
+}
+
+// Set the most processes that may exist at once to n, if n
+// is positive, and return the old limit. lowering it below
+// the number that exist only stops new ones being made.
+int
+kmaxproc(int n)
+{
+  int old;
+
+  if(n > NPROCMAX)
+    return -1;
+  acquire(&pid_lock);
+  old = maxproc;
+  if(n > 0)
+    maxproc = n;
+  release(&pid_lock);
+  return old;
+}
+
+// Set the nice value of process pid, or of the caller if pid
+// is 0, to nice. Returns the old value, or -1.
+int
+ksetpriority(int pid, int nice)
+{
+  struct proc *p;
+  int old;
+
+  if(nice < 0 || nice > NICEMAX)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  old = p->nice;
+  p->nice = nice;
+  if(p->prio < baseprio(p))
+    p->prio = baseprio(p);
+  release(&p->lock);
+  return old;
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch to forkret.
 void
 forkret(void)
 {
-  extern char userret[];
   static int first = 1;
   struct proc *p = myproc();
 
@@ -574,9 +1272,15 @@ forkret(void)
   }
 
   // return to user space, mimicing usertrap()'s return.
-  uint64 satp = MAKE_SATP(p->pagetable);
-  uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64))trampoline_userret)(satp);
+  usertrapret();
+}
+
+static struct waitq*
+waitq(void *chan)
+{
+  uint64 h = ((uint64)chan >> 3) * 0x9e3779b97f4a7c15ULL;
+
+  return &waitqs[(h >> 32) % NWAITQ];
 }
 
 // Sleep on channel chan, releasing condition lock lk.
@@ -585,7 +1289,18 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
-  
+  struct waitq *wq = waitq(chan);
+
+  // Join chan's wait queue while still holding lk, so that a
+  // wakeup() by a caller that holds lk finds p there.
+  acquire(&wq->lock);
+  p->wqnext = wq->head;
+  p->wqprev = &wq->head;
+  if(wq->head)
+    wq->head->wqprev = &p->wqnext;
+  wq->head = p;
+  release(&wq->lock);
+
   // Must acquire p->lock in order to
   // change p->state and then call sched.
   // Once we hold p->lock, we can be
@@ -604,9 +1319,15 @@ sleep(void *chan, struct spinlock *lk)
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  acquire(&wq->lock);
+  *p->wqprev = p->wqnext;
+  if(p->wqnext)
+    p->wqnext->wqprev = p->wqprev;
+  release(&wq->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
@@ -615,17 +1336,20 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
+  struct waitq *wq = waitq(chan);
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  acquire(&wq->lock);
+  for(p = wq->head; p; p = p->wqnext) {
     if(p != myproc()){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+        setrunnable(p);
       }
       release(&p->lock);
     }
   }
+  release(&wq->lock);
 }
 
 // Kill the process with the given pid.
@@ -636,20 +1360,15 @@ kkill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
-    release(&p->lock);
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    setrunnable(p);
   }
-  return -1;
+  release(&p->lock);
+  return 0;
 }
 
 void
@@ -679,7 +1398,7 @@ either_copyout(int user_dst, uint64 dst, void *src, uint64 len)
 {
   struct proc *p = myproc();
   if(user_dst){
-    return copyout(p->pagetable, dst, src, len);
+    return copyout(p->mm->pagetable, dst, src, len);
   } else {
     memmove((char *)dst, src, len);
     return 0;
@@ -694,7 +1413,7 @@ either_copyin(void *dst, int user_src, uint64 src, uint64 len)
 {
   struct proc *p = myproc();
   if(user_src){
-    return copyin(p->pagetable, dst, src, len);
+    return copyin(p->mm->pagetable, dst, src, len);
   } else {
     memmove(dst, (char*)src, len);
     return 0;
@@ -719,14 +1438,35 @@ procdump(void)
   char *state;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
+  for(p = allprocs; p; p = p->allnext){
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
       state = states[p->state];
     else
       state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
+    printf("%d %s %s rss %lu prio %d nice %d cpu %d", p->pid, state, p->name,
+           p->mm ? p->mm->rss : 0, p->prio, p->nice, p->cpu);
     printf("\n");
   }
+
+  struct memstat ms;
+  kmemstat(&ms);
+  printf("mem: %lu free, %lu used (pgtbl %lu anon %lu file %lu kernel %lu) pages\n",
+         ms.free, ms.used, ms.bytype[KMEM_PGTBL], ms.bytype[KMEM_ANON],
+         ms.bytype[KMEM_FILE], ms.bytype[KMEM_KERNEL]);
+}
+
+// Look up the resident set size, in pages, of process pid.
+// Returns 0 on success, -1 if there is no such process.
+int
+procrss(int pid, uint64 *rss)
+{
+  struct proc *p;
+
+  if((p = findproc(pid)) == 0)
+    return -1;
+  *rss = p->mm ? p->mm->rss : 0;
+  release(&p->lock);
+  return 0;
 }
@@ -26,6 +26,10 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation this TLB was last flushed for.
+  struct proc *vowner;        // Whose vector registers the hart holds, or null.
+  int idle;                   // In scheduler(), maybe in wfi, with nothing to run?
+  uint64 rcuepoch;            // RCU epoch at its last quiescent state (rcu.c)
 };
 
 extern struct cpu cpus[NCPU];
@@ -96,6 +100,34 @@ struct mmap_area {
   int used;          // 0 = free, 1 = used
 };
 
+// A user address space, shared by the threads clone() makes.
+struct mm {
+  struct spinlock lock;        // guards the page table, sz, rss and mmap_areas
+
+  int ref;                     // Threads using it
+  uint64 tslots;               // THREADFRAME() slots in use, a bit each
+  pagetable_t pagetable;       // User page table
+  pagetable_t kpagetable;      // Kernel page table for uaccess()
+  uint64 sz;                   // Size of process memory (bytes)
+  uint64 rss;                  // Resident user pages
+  uint64 memlimit;             // Max resident pages, 0 if unlimited
+  uint64 asid;                 // Address-space ID of pagetable
+  uint64 asidgen;              // Generation asid belongs to, 0 if none
+  uint64 tlbstale;             // cpus to flush asid before using it
+  int unmapping;               // do_munmap() is writing back pages
+
+  // Memory-mapped regions
+  struct mmap_area mmap_areas[MAX_MMAP_AREAS];
+  uint64 mmap_hint;            // optional: next free VA hint
+};
+
+// Open files, shared by the threads clone() makes.
+struct fdtable {
+  struct spinlock lock;        // guards ofile[] slots being claimed
+  int ref;                     // Threads using it
+  struct file *ofile[NOFILE];  // Open files
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -106,23 +138,42 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // Hart it last ran on, or -1
+  uint64 affinity;             // Harts it may run on, a bit each
+  int nice;                    // 0..NICEMAX; higher runs less
+  int prio;                    // Run queue level, 0 first
+  int used;                    // Ticks of its time slice used
+  uint boost;                  // Priority boosts seen (MLFQ)
+
+  // the lock of the run queue it is on guards this:
+  struct proc *rqnext;         // Next on a run queue
+
+  // the lock of the wait queue it is on guards these:
+  struct proc *wqnext;         // Next sleeping on a wait queue
+  struct proc **wqprev;        // What points to it there
 
-  // wait_lock must be held when using this:
+  // wait_lock must be held when using these:
   struct proc *parent;         // Parent process
+  struct proc *children;       // Its children, linked by sibling
+  struct proc *sibling;        // Next child of parent
+  int vfork;                   // Parent waits in vfork() until 0
+
+  // pid_lock must be held when using this:
+  struct proc *pidnext;        // Next in pid hash chain or free list
+
+  struct proc *allnext;        // Next in allprocs; set once, when made
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table
+  struct mm *mm;               // Address space, maybe shared
+  int tslot;                   // trapframe is at THREADFRAME(tslot)
   struct trapframe *trapframe; // data page for trampoline.S
+  struct vstate *vstate;       // Saved vector registers, if it uses V
+  int vcpu;                    // Last cpu to load them, or -1
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
+  struct fdtable *fdt;         // Open files, maybe shared
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
-  
-  // Memory-mapped regions
-  struct mmap_area mmap_areas[MAX_MMAP_AREAS];
-  uint64 mmap_hint;            // optional: next free VA hint
 };
 
 #endif // PROC_H
\ No newline at end of file
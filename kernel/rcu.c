@@ -0,0 +1,103 @@
+//
+// Read-copy update, by epochs.
+//
+// readers of an RCU-protected structure, such as the directory
+// entry cache, bracket their accesses with rcu_read_lock() and
+// rcu_read_unlock(), which only turn interrupts off: a reader
+// takes no lock and writes nothing shared. a writer, holding
+// the structure's own lock, unlinks an object so that new
+// readers cannot find it, but may reuse it only once every
+// reader that might have found it before is done.
+//
+// a hart cannot be in a read-side section while it is in
+// scheduler() between processes, or when it takes an interrupt.
+// at those quiescent states it records the current epoch in
+// cpu->rcuepoch. rcuretire() starts a new epoch after an
+// unlink; rcuelapsed() says whether every running hart has
+// since recorded it, or sits idle, after which objects retired
+// in that epoch are unreachable. rcuwait() waits for that,
+// interrupting the other harts so that they need not reach
+// their next context switch first.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+uint64 rcuepoch = 1;
+extern uint64 onlinecpus;
+
+void
+rcu_read_lock(void)
+{
+  push_off();
+}
+
+void
+rcu_read_unlock(void)
+{
+  pop_off();
+}
+
+// Note a quiescent state for this hart.
+// Called with interrupts off.
+void
+rcuquiesce(void)
+{
+  mycpu()->rcuepoch = *(volatile uint64 *)&rcuepoch;
+  // later read-side sections load only after the epoch.
+  __sync_synchronize();
+}
+
+// Start a new epoch, once a writer has unlinked objects, and
+// return it for rcuelapsed().
+uint64
+rcuretire(void)
+{
+  __sync_synchronize();  // readers that see the new epoch see the unlink
+  return __sync_add_and_fetch(&rcuepoch, 1);
+}
+
+// Has every other hart passed a quiescent state since epoch
+// e began? the caller must not be in a read-side section, so
+// its own hart counts as quiescent.
+int
+rcuelapsed(uint64 e)
+{
+  int id;
+
+  push_off();
+  id = cpuid();
+  __sync_synchronize();
+  for(int i = 0; i < NCPU; i++){
+    if(i == id || (onlinecpus & (1L << i)) == 0)
+      continue;
+    if(*(volatile int *)&cpus[i].idle == 0 &&
+       *(volatile uint64 *)&cpus[i].rcuepoch < e){
+      pop_off();
+      return 0;
+    }
+  }
+  pop_off();
+  return 1;
+}
+
+// Wait until epoch e has elapsed.
+void
+rcuwait(uint64 e)
+{
+  uint64 others;
+
+  if(rcuelapsed(e))
+    return;
+  push_off();
+  others = onlinecpus & ~(1L << cpuid());
+  pop_off();
+  ipikick(others);
+  while(!rcuelapsed(e))
+    yield();
+}
@@ -43,6 +43,11 @@ w_mepc(uint64 x)
 
 // Supervisor Status Register, sstatus
 
+#define SSTATUS_SUM (1L << 18) // Supervisor may access User memory
+#define SSTATUS_VS (3L << 9)   // Vector unit state: off, or
+#define SSTATUS_VS_INITIAL (1L << 9)
+#define SSTATUS_VS_CLEAN (2L << 9)
+#define SSTATUS_VS_DIRTY (3L << 9)
 #define SSTATUS_SPP (1L << 8)  // Previous mode, 1=Supervisor, 0=User
 #define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
@@ -81,6 +86,7 @@ w_sip(uint64 x)
 // Supervisor Interrupt Enable
 #define SIE_SEIE (1L << 9) // external
 #define SIE_STIE (1L << 5) // timer
+#define SIE_SSIE (1L << 1) // software
 static inline uint64
 r_sie()
 {
@@ -97,6 +103,7 @@ w_sie(uint64 x)
 
 // Machine-mode Interrupt Enable
 #define MIE_STIE (1L << 5)  // supervisor timer
+#define MIE_MSIE (1L << 3)  // machine software
 static inline uint64
 r_mie()
 {
@@ -221,11 +228,34 @@ w_pmpaddr0(uint64 x)
   asm volatile("csrw pmpaddr0, %0" : : "r" (x));
 }
 
+// Machine-mode interrupt vector
+static inline void 
+w_mtvec(uint64 x)
+{
+  asm volatile("csrw mtvec, %0" : : "r" (x));
+}
+
+static inline void 
+w_mscratch(uint64 x)
+{
+  asm volatile("csrw mscratch, %0" : : "r" (x));
+}
+
 // use riscv's sv39 page table scheme.
 #define SATP_SV39 (8L << 60)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
 
+// the address-space identifier field of satp. TLB entries are
+// tagged with the ASID they were loaded under, so address spaces
+// with different ASIDs need no flush when switching between them.
+// the kernel page table uses ASID 0.
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK 0xffffL
+#define SATP_ASID(satp) (((satp) >> SATP_ASID_SHIFT) & SATP_ASID_MASK)
+#define MAKE_SATP_ASID(pagetable, asid) \
+  (MAKE_SATP(pagetable) | ((uint64)(asid) << SATP_ASID_SHIFT))
+
 // supervisor address translation and protection;
 // holds the address of the page table.
 static inline void 
@@ -346,6 +376,20 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of one address space.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid));
+}
+
+// flush the TLB entry for one page of one address space.
+static inline void
+sfence_vma_page(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid));
+}
+
 typedef uint64 pte_t;
 typedef uint64 *pagetable_t; // 512 PTEs
 
@@ -353,6 +397,7 @@ typedef uint64 *pagetable_t; // 512 PTEs
 
 #define PGSIZE 4096 // bytes per page
 #define PGSHIFT 12  // bits of offset within a page
+#define MEGAPGSIZE (PGSIZE << 9) // bytes mapped by a level-1 leaf PTE
 
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
@@ -362,6 +407,9 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
+#define PTE_A (1L << 6) // accessed, set by hardware
+#define PTE_D (1L << 7) // dirty, set by hardware
+#define PTE_GUARD (1L << 8) // software: invalid, a guard page
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -0,0 +1,76 @@
+//
+// Slab allocation of kernel objects smaller than a page, such
+// as struct proc and struct mm, so that how many there can be
+// is bounded by memory rather than by static arrays.
+//
+// a slab cache carves pages from kalloc() into objects of one
+// size and keeps the free ones on a list. pages are not given
+// back, so a cache holds on to as much memory as it once
+// needed at the most.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "slab.h"
+#include "memstat.h"
+#include "defs.h"
+
+void
+slabinit(struct slab *s, char *name, uint size)
+{
+  initlock(&s->lock, name);
+  size = (size + 7) & ~7;   // keep objects 8-byte aligned
+  if(size > PGSIZE)
+    panic("slabinit");
+  s->size = size;
+  s->free = 0;
+  s->npages = 0;
+}
+
+// Carve a fresh page into free objects.
+// Called with s->lock held.
+static int
+slabgrow(struct slab *s)
+{
+  char *page, *o;
+
+  if((page = kalloctype(KMEM_KERNEL)) == 0)
+    return -1;
+  for(o = page; o + s->size <= page + PGSIZE; o += s->size){
+    *(void**)o = s->free;
+    s->free = o;
+  }
+  s->npages++;
+  return 0;
+}
+
+// Allocate a zeroed object from s.
+// Returns 0 if memory is short.
+void*
+slaballoc(struct slab *s)
+{
+  void *o;
+
+  acquire(&s->lock);
+  if(s->free == 0 && slabgrow(s) < 0){
+    release(&s->lock);
+    return 0;
+  }
+  o = s->free;
+  s->free = *(void**)o;
+  release(&s->lock);
+  memset(o, 0, s->size);
+  return o;
+}
+
+// Return object o to s.
+void
+slabfree(struct slab *s, void *o)
+{
+  acquire(&s->lock);
+  *(void**)o = s->free;
+  s->free = o;
+  release(&s->lock);
+}
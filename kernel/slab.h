@@ -0,0 +1,7 @@
+// A cache of fixed-size kernel objects, carved from pages.
+struct slab {
+  struct spinlock lock;
+  uint size;         // bytes per object
+  void *free;        // free objects, linked through their first word
+  uint64 npages;     // pages taken from kalloc()
+};
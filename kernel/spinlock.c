@@ -1,4 +1,11 @@
 // Mutual exclusion spin locks.
+//
+// each lock counts its acquisitions, those that had to wait,
+// and the time spent waiting, in a struct lockstat shared by
+// all locks of the same name (every proc's p->lock is "proc"),
+// so that lockdump() can show which locks harts queue on.
+// the counters are kept per hart and updated with interrupts
+// off, so no atomic instructions are needed.
 
 #include "types.h"
 #include "param.h"
@@ -8,12 +15,48 @@
 #include "proc.h"
 #include "defs.h"
 
+#define NLOCKSTAT 64
+
+// each hart's counters get a cache line of their own, and the
+// name, which every hart reads, comes after them.
+struct lockstat {
+  struct {
+    uint64 nacquire;     // acquisitions
+    uint64 ncontended;   // acquisitions that found the lock held
+    uint64 spin;         // time CSR ticks spent waiting
+  } __attribute__ ((aligned (64))) cpu[NCPU];
+  char *name;
+} __attribute__ ((aligned (64)));
+
+__attribute__ ((aligned (64))) struct lockstat lockstats[NLOCKSTAT];
+
+// Find the counters for locks named name, claiming a free
+// entry for a new name. initlock() may run on several harts at
+// once, so entries are claimed with compare-and-swap; locks of
+// names beyond NLOCKSTAT share the last entry.
+static struct lockstat*
+lockstat(char *name)
+{
+  struct lockstat *s;
+
+  for(s = lockstats; s < &lockstats[NLOCKSTAT-1]; s++){
+    if(s->name == 0)
+      __sync_bool_compare_and_swap(&s->name, 0, name);
+    if(strncmp(s->name, name, 32) == 0)
+      return s;
+  }
+  s->name = "other";
+  return s;
+}
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
   lk->cpu = 0;
+  lk->stat = lockstat(name);
 }
 
 // Acquire the lock.
@@ -25,12 +68,22 @@ acquire(struct spinlock *lk)
   if(holding(lk))
     panic("acquire");
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-  //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  // On RISC-V, sync_fetch_and_add turns into an atomic add:
+  //   amoadd.w a5, a5, (s1)
+  // waiting then only reads owner, so the line holding the
+  // lock is not written by the waiters.
+  //
+  // the holder may be waiting, with interrupts off, for this
+  // hart to flush its TLB (see ipi.c), so do that while spinning.
+  uint ticket = __sync_fetch_and_add(&lk->next, 1);
+  uint64 start = 0;
+  int waited = 0;
+  if(*(volatile uint *)&lk->owner != ticket){
+    waited = 1;
+    start = r_time();
+    while(*(volatile uint *)&lk->owner != ticket)
+      tlbflushreqs();
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +93,14 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+  if(lk->stat){
+    int id = cpuid();
+    lk->stat->cpu[id].nacquire++;
+    if(waited){
+      lk->stat->cpu[id].ncontended++;
+      lk->stat->cpu[id].spin += r_time() - start;
+    }
+  }
 }
 
 // Release the lock.
@@ -59,14 +120,10 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code doesn't use a C assignment, since the C standard
-  // implies that an assignment might be implemented with
-  // multiple store instructions.
-  // On RISC-V, sync_lock_release turns into an atomic swap:
-  //   s1 = &lk->locked
-  //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  // Release the lock, handing it to the next ticket. only
+  // the holder writes owner, so a plain store will do; it is
+  // volatile so that the compiler makes it a single store.
+  *(volatile uint *)&lk->owner = lk->owner + 1;
 
   pop_off();
 }
@@ -77,10 +134,36 @@ int
 holding(struct spinlock *lk)
 {
   int r;
-  r = (lk->locked && lk->cpu == mycpu());
+  r = (lk->owner != lk->next && lk->cpu == mycpu());
   return r;
 }
 
+// Print the counters of each lock name that has been
+// acquired, summed over harts. For finding contended locks;
+// runs when the user types ^L on the console.
+void
+lockdump(void)
+{
+  struct lockstat *s;
+  uint64 n, contended, spin;
+
+  printf("\nlock             acquires  contended  spin(ticks)\n");
+  for(s = lockstats; s < &lockstats[NLOCKSTAT] && s->name; s++){
+    n = contended = spin = 0;
+    for(int i = 0; i < NCPU; i++){
+      n += s->cpu[i].nacquire;
+      contended += s->cpu[i].ncontended;
+      spin += s->cpu[i].spin;
+    }
+    if(n == 0)
+      continue;
+    printf("%s", s->name);
+    for(int i = strlen(s->name); i < 16; i++)
+      printf(" ");
+    printf(" %ld %ld %ld\n", n, contended, spin);
+  }
+}
+
 // push_off/pop_off are like intr_off()/intr_on() except that they are matched:
 // it takes two pop_off()s to undo two push_off()s.  Also, if interrupts
 // are initially off, then push_off, pop_off leaves them off.
@@ -1,12 +1,16 @@
 #ifndef SPINLOCK_H
 #define SPINLOCK_H
-// Mutual exclusion lock.
+// Mutual exclusion lock: a ticket lock. an acquirer takes the
+// next ticket and waits until owner reaches it, so that harts
+// get the lock in the order they asked for it.
 struct spinlock {
-  uint locked;       // Is the lock held?
+  uint next;         // Next ticket to hand out
+  uint owner;        // Ticket now allowed to hold the lock
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+  struct lockstat *stat; // Counters for locks of this name
 };
 
-#endif // SPINLOCK_H
\ No newline at end of file
+#endif // SPINLOCK_H
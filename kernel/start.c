@@ -6,13 +6,24 @@
 
 void main();
 void timerinit();
+void ipiinit(int);
+
+// physical address of the device tree blob, for fdtinit().
+uint64 dtb_pa;
 
 // entry.S needs one stack per CPU.
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
-// entry.S jumps here in machine mode on stack0.
+// scratch space for machinevec in kernelvec.S, per CPU.
+uint64 ipi_scratch[NCPU][3];
+
+// kernelvec.S's machine-mode interrupt handler.
+extern void machinevec();
+
+// entry.S jumps here in machine mode on stack0,
+// with the DTB address qemu passed in a1.
 void
-start()
+start(uint64 dtb)
 {
   // set M Previous Privilege mode to Supervisor, for mret.
   unsigned long x = r_mstatus();
@@ -30,7 +41,7 @@ start()
   // delegate all interrupts and exceptions to supervisor mode.
   w_medeleg(0xffff);
   w_mideleg(0xffff);
-  w_sie(r_sie() | SIE_SEIE | SIE_STIE);
+  w_sie(r_sie() | SIE_SEIE | SIE_STIE | SIE_SSIE);
 
   // configure Physical Memory Protection to give supervisor mode
   // access to all of physical memory.
@@ -44,6 +55,13 @@ start()
   int id = r_mhartid();
   w_tp(id);
 
+  // let other harts interrupt this one.
+  ipiinit(id);
+
+  // remember the DTB; main() parses it on hart 0.
+  if(id == 0)
+    dtb_pa = dtb;
+
   // switch to supervisor mode and jump to main().
   asm volatile("mret");
 }
@@ -61,6 +79,18 @@ timerinit()
   // allow supervisor to use stimecmp and time.
   w_mcounteren(r_mcounteren() | 2);
   
-  // ask for the very first timer interrupt.
-  w_stimecmp(r_time() + 1000000);
+  // ask for the very first timer interrupt; after that,
+  // timerarm() in timer.c asks only when needed.
+  w_stimecmp(r_time() + TIMEBASE / HZ);
+}
+
+// take machine-mode software interrupts, which only the CLINT
+// raises, in machinevec, which passes them on to supervisor mode.
+void
+ipiinit(int id)
+{
+  ipi_scratch[id][2] = CLINT_MSIP(id);
+  w_mscratch((uint64)ipi_scratch[id]);
+  w_mtvec((uint64)machinevec);
+  w_mie(r_mie() | MIE_MSIE);
 }
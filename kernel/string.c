@@ -1,13 +1,54 @@
 #include "types.h"
+#include "riscv.h"
+
+#ifdef RVV
+// vector.c supplies these, falling back on the versions here
+// when the hart has no vector unit.
+#define memcmp scalar_memcmp
+#define copy_page scalar_copy_page
+#define clear_page scalar_clear_page
+#define checksum scalar_checksum
+#endif
+
+// memset(), memmove() and memcmp() work a 64-bit word at a time
+// where the addresses allow it, and in unrolled runs of four
+// words. word_t may alias anything, so the compiler won't assume
+// a char buffer and a word access don't overlap.
+typedef uint64 __attribute__((may_alias)) word_t;
+
+#define WSIZE   sizeof(word_t)
+#define WMASK   (WSIZE - 1)
+#define ALIGNED(a) (((uint64)(a) & WMASK) == 0)
 
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  word_t w, *wdst;
+
+  // bytes up to a word boundary.
+  while(n > 0 && !ALIGNED(cdst)){
+    *cdst++ = c;
+    n--;
+  }
+
+  w = (uchar)c;
+  w |= w << 8;
+  w |= w << 16;
+  w |= w << 32;
+  wdst = (word_t *) cdst;
+  for(; n >= 4*WSIZE; n -= 4*WSIZE, wdst += 4){
+    wdst[0] = w;
+    wdst[1] = w;
+    wdst[2] = w;
+    wdst[3] = w;
   }
+  for(; n >= WSIZE; n -= WSIZE)
+    *wdst++ = w;
+
+  cdst = (char *) wdst;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -18,6 +59,19 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  // skip equal words; the byte loop finds where a word differs.
+  if(((uint64)s1 & WMASK) == ((uint64)s2 & WMASK)){
+    while(n > 0 && !ALIGNED(s1)){
+      if(*s1 != *s2)
+        return *s1 - *s2;
+      s1++, s2++, n--;
+    }
+    while(n >= WSIZE && *(const word_t *)s1 == *(const word_t *)s2){
+      s1 += WSIZE;
+      s2 += WSIZE;
+      n -= WSIZE;
+    }
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -38,14 +92,60 @@ memmove(void *dst, const void *src, uint n)
   
   s = src;
   d = dst;
+  // words only help if src and dst can both be aligned.
+  int words = ((uint64)s & WMASK) == ((uint64)d & WMASK);
+
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(words){
+      while(n > 0 && !ALIGNED(d)){
+        *--d = *--s;
+        n--;
+      }
+      for(; n >= 4*WSIZE; n -= 4*WSIZE){
+        d -= 4*WSIZE;
+        s -= 4*WSIZE;
+        ((word_t *)d)[3] = ((const word_t *)s)[3];
+        ((word_t *)d)[2] = ((const word_t *)s)[2];
+        ((word_t *)d)[1] = ((const word_t *)s)[1];
+        ((word_t *)d)[0] = ((const word_t *)s)[0];
+      }
+      for(; n >= WSIZE; n -= WSIZE){
+        d -= WSIZE;
+        s -= WSIZE;
+        *(word_t *)d = *(const word_t *)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(words){
+      while(n > 0 && !ALIGNED(d)){
+        *d++ = *s++;
+        n--;
+      }
+      for(; n >= 4*WSIZE; n -= 4*WSIZE){
+        word_t w0 = ((const word_t *)s)[0];
+        word_t w1 = ((const word_t *)s)[1];
+        word_t w2 = ((const word_t *)s)[2];
+        word_t w3 = ((const word_t *)s)[3];
+        ((word_t *)d)[0] = w0;
+        ((word_t *)d)[1] = w1;
+        ((word_t *)d)[2] = w2;
+        ((word_t *)d)[3] = w3;
+        s += 4*WSIZE;
+        d += 4*WSIZE;
+      }
+      for(; n >= WSIZE; n -= WSIZE){
+        *(word_t *)d = *(const word_t *)s;
+        s += WSIZE;
+        d += WSIZE;
+      }
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
@@ -57,6 +157,53 @@ memcpy(void *dst, const void *src, uint n)
   return memmove(dst, src, n);
 }
 
+// Copy one page-aligned page to another, eight words at a time.
+void
+copy_page(void *dst, const void *src)
+{
+  word_t *d = dst;
+  const word_t *s = src;
+
+  for(int i = 0; i < PGSIZE / WSIZE; i += 8, d += 8, s += 8){
+    word_t w0 = s[0], w1 = s[1], w2 = s[2], w3 = s[3];
+    word_t w4 = s[4], w5 = s[5], w6 = s[6], w7 = s[7];
+    d[0] = w0; d[1] = w1; d[2] = w2; d[3] = w3;
+    d[4] = w4; d[5] = w5; d[6] = w6; d[7] = w7;
+  }
+}
+
+// The sum of the n/4 32-bit words at p, which must be 4-byte
+// aligned, mod 2^32.
+uint32
+checksum(const void *p, uint n)
+{
+  const uint32 *w = p;
+  uint32 s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+  n /= 4;
+  for(; n >= 4; n -= 4, w += 4){
+    s0 += w[0];
+    s1 += w[1];
+    s2 += w[2];
+    s3 += w[3];
+  }
+  while(n-- > 0)
+    s0 += *w++;
+  return s0 + s1 + s2 + s3;
+}
+
+// Zero one page-aligned page.
+void
+clear_page(void *dst)
+{
+  word_t *d = dst;
+
+  for(int i = 0; i < PGSIZE / WSIZE; i += 8, d += 8){
+    d[0] = 0; d[1] = 0; d[2] = 0; d[3] = 0;
+    d[4] = 0; d[5] = 0; d[6] = 0; d[7] = 0;
+  }
+}
+
 int
 strncmp(const char *p, const char *q, uint n)
 {
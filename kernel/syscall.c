@@ -12,9 +12,9 @@ int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz) // both tests needed, in case of overflow
+  if(addr >= p->mm->sz || addr+sizeof(uint64) > p->mm->sz) // both tests needed, in case of overflow
     return -1;
-  if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
+  if(copyin(p->mm->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
   return 0;
 }
@@ -25,7 +25,7 @@ int
 fetchstr(uint64 addr, char *buf, int max)
 {
   struct proc *p = myproc();
-  if(copyinstr(p->pagetable, buf, addr, max) < 0)
+  if(copyinstr(p->mm->pagetable, buf, addr, max) < 0)
     return -1;
   return strlen(buf);
 }
@@ -118,6 +118,18 @@ extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
 extern uint64 sys_mmap(void);
 extern uint64 sys_munmap(void);
+extern uint64 sys_memstat(void);
+extern uint64 sys_memlimit(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_futex(void);
+extern uint64 sys_setpriority(void);
+extern uint64 sys_sched_setaffinity(void);
+extern uint64 sys_sched_getaffinity(void);
+extern uint64 sys_sleepuntil(void);
+extern uint64 sys_uptimeus(void);
+extern uint64 sys_maxproc(void);
+extern uint64 sys_vfork(void);
+extern uint64 sys_spawn(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -145,6 +157,18 @@ static uint64 (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_mmap]    sys_mmap,
 [SYS_munmap]  sys_munmap,
+[SYS_memstat] sys_memstat,
+[SYS_memlimit] sys_memlimit,
+[SYS_clone]   sys_clone,
+[SYS_futex]   sys_futex,
+[SYS_setpriority] sys_setpriority,
+[SYS_sched_setaffinity] sys_sched_setaffinity,
+[SYS_sched_getaffinity] sys_sched_getaffinity,
+[SYS_sleepuntil] sys_sleepuntil,
+[SYS_uptimeus] sys_uptimeus,
+[SYS_maxproc] sys_maxproc,
+[SYS_vfork]   sys_vfork,
+[SYS_spawn]   sys_spawn,
 };
 
 void
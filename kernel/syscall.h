@@ -22,3 +22,15 @@
 #define SYS_close  21
 #define SYS_mmap   22
 #define SYS_munmap 23
+#define SYS_memstat 24
+#define SYS_memlimit 25
+#define SYS_clone  26
+#define SYS_futex  27
+#define SYS_setpriority 28
+#define SYS_sched_setaffinity 29
+#define SYS_sched_getaffinity 30
+#define SYS_sleepuntil 31
+#define SYS_uptimeus 32
+#define SYS_maxproc 33
+#define SYS_vfork 34
+#define SYS_spawn 35
@@ -25,7 +25,7 @@ argfd(int n, int *pfd, struct file **pf)
   struct file *f;
 
   argint(n, &fd);
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fd < 0 || fd >= NOFILE || (f=myproc()->fdt->ofile[fd]) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -40,14 +40,18 @@ static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct fdtable *fdt = myproc()->fdt;
 
+  // other threads may share the table.
+  acquire(&fdt->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
+    if(fdt->ofile[fd] == 0){
+      fdt->ofile[fd] = f;
+      release(&fdt->lock);
       return fd;
     }
   }
+  release(&fdt->lock);
   return -1;
 }
 
@@ -99,10 +103,18 @@ sys_close(void)
 {
   int fd;
   struct file *f;
+  struct fdtable *fdt = myproc()->fdt;
 
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
+  acquire(&fdt->lock);
+  if(fdt->ofile[fd] != f){
+    // another thread closed it first.
+    release(&fdt->lock);
+    return -1;
+  }
+  fdt->ofile[fd] = 0;
+  release(&fdt->lock);
   fileclose(f);
   return 0;
 }
@@ -222,6 +234,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcacheremove(dp, name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -431,20 +444,29 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+static void
+freeargv(char **argv)
+{
+  for(int i = 0; i < MAXARG && argv[i] != 0; i++)
+    kfree(argv[i]);
+}
+
+// Fetch the path and the argv[] array of exec() or spawn()
+// from the system call arguments, each string in a page of
+// its own. Returns 0, or -1 having freed what it fetched.
+static int
+fetchexecargs(char *path, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
   uint64 uargv, uarg;
 
   argaddr(1, &uargv);
+  memset(argv, 0, MAXARG * sizeof(char*));
   if(argstr(0, path, MAXPATH) < 0) {
     return -1;
   }
-  memset(argv, 0, sizeof(argv));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
+    if(i >= MAXARG){
       goto bad;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
@@ -460,18 +482,37 @@ sys_exec(void)
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
       goto bad;
   }
+  return 0;
 
-  int ret = kexec(path, argv);
+ bad:
+  freeargv(argv);
+  return -1;
+}
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
 
+  if(fetchexecargs(path, argv) < 0)
+    return -1;
+  int ret = kexec(path, argv);
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+// start a child running a program, without copying this
+// process's memory.
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+
+  if(fetchexecargs(path, argv) < 0)
+    return -1;
+  int ret = kspawn(path, argv);
+  freeargv(argv);
+  return ret;
 }
 
 uint64
@@ -488,15 +529,15 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      p->fdt->ofile[fd0] = 0;
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
-  if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
-     copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+  if(copyout(p->mm->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
+     copyout(p->mm->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
+    p->fdt->ofile[fd0] = 0;
+    p->fdt->ofile[fd1] = 0;
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -6,6 +6,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "vm.h"
+#include "memstat.h"
 
 uint64
 sys_exit(void)
@@ -28,6 +29,41 @@ sys_fork(void)
   return kfork();
 }
 
+// like fork(), but the child borrows this process's memory,
+// which waits until the child calls exec() or exit().
+uint64
+sys_vfork(void)
+{
+  return kvfork();
+}
+
+// start a thread sharing this process's memory and open
+// files, running fn(arg) on stack.
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  argaddr(0, &fn);
+  argaddr(1, &arg);
+  argaddr(2, &stack);
+  return kclone(fn, arg, stack);
+}
+
+// sleep or wake on a word of memory shared between threads.
+uint64
+sys_futex(void)
+{
+  uint64 addr, addr2;
+  int op, val;
+
+  argaddr(0, &addr);
+  argint(1, &op);
+  argint(2, &val);
+  argaddr(3, &addr2);
+  return futex(addr, op, val, addr2);
+}
+
 uint64
 sys_wait(void)
 {
@@ -39,13 +75,15 @@ sys_wait(void)
 uint64
 sys_sbrk(void)
 {
+  struct mm *mm;
   uint64 addr;
   int t;
   int n;
 
   argint(0, &n);
   argint(1, &t);
-  addr = myproc()->sz;
+  mm = myproc()->mm;
+  addr = mm->sz;
 
   if(t == SBRK_EAGER || n < 0) {
     if(growproc(n) < 0) {
@@ -54,12 +92,16 @@ sys_sbrk(void)
   } else {
     // Lazily allocate memory for this process: increase its memory
     // size but don't allocate memory. If the processes uses the
-    // memory, vmfault() will allocate it.
-    if(addr + n < addr)
+    // memory, vmfault() will allocate it. the heap stays
+    // below any mmap() mapping.
+    acquire(&mm->lock);
+    addr = mm->sz;
+    if(PGROUNDUP(addr + n) > mmapbase(mm)) {
+      release(&mm->lock);
       return -1;
-    if(addr + n > TRAPFRAME)
-      return -1;
-    myproc()->sz += n;
+    }
+    mm->sz += n;
+    release(&mm->lock);
   }
   return addr;
 }
@@ -68,21 +110,79 @@ uint64
 sys_pause(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
   if(n < 0)
     n = 0;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
+  return sleepuntil(r_time() + (uint64)n * (timebase / HZ));
+}
+
+// sleep until a time, in microseconds since boot.
+uint64
+sys_sleepuntil(void)
+{
+  uint64 us;
+
+  argaddr(0, &us);
+  return sleepuntil(ustotime(us));
+}
+
+// microseconds since boot.
+uint64
+sys_uptimeus(void)
+{
+  return uptimeus();
+}
+
+// set the most processes that may exist at once, if the
+// argument is positive, returning the old limit.
+uint64
+sys_maxproc(void)
+{
+  int n;
+
+  argint(0, &n);
+  return kmaxproc(n);
+}
+
+// set the nice value of a process (0 means the caller),
+// returning the old one.
+uint64
+sys_setpriority(void)
+{
+  int pid, nice;
+
+  argint(0, &pid);
+  argint(1, &nice);
+  return ksetpriority(pid, nice);
+}
+
+// limit a process (0 means the caller) to the harts in a
+// mask, a bit each.
+uint64
+sys_sched_setaffinity(void)
+{
+  int pid;
+  uint64 mask;
+
+  argint(0, &pid);
+  argaddr(1, &mask);
+  return ksetaffinity(pid, mask);
+}
+
+// copy out the mask of harts a process may run on.
+uint64
+sys_sched_getaffinity(void)
+{
+  int pid;
+  uint64 addr, mask;
+
+  argint(0, &pid);
+  argaddr(1, &addr);
+  if(kgetaffinity(pid, &mask) < 0)
+    return -1;
+  if(copyout(myproc()->mm->pagetable, addr, (char *)&mask, sizeof(mask)) < 0)
+    return -1;
   return 0;
 }
 
@@ -95,15 +195,55 @@ sys_kill(void)
   return kkill(pid);
 }
 
-// return how many clock tick interrupts have occurred
-// since start.
+// return how many ticks of 1/HZ seconds have passed since
+// boot, computed from the time CSR.
 uint64
 sys_uptime(void)
 {
-  uint xticks;
+  return uptime();
+}
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+// report physical memory use, and the resident set
+// size of process pid (0 means the caller).
+uint64
+sys_memstat(void)
+{
+  int pid;
+  uint64 addr;
+  struct memstat st;
+  struct proc *p = myproc();
+
+  argint(0, &pid);
+  argaddr(1, &addr);
+  if(pid == 0)
+    pid = p->pid;
+  kmemstat(&st);
+  if(procrss(pid, &st.rss) < 0)
+    return -1;
+  if(copyout(p->mm->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// limit the caller, and children it creates afterwards,
+// to n resident pages. a limit can only be lowered, so
+// a supervisor can confine what it starts.
+// returns the old limit (0 means unlimited).
+uint64
+sys_memlimit(void)
+{
+  int n;
+  struct mm *mm = myproc()->mm;
+  uint64 old;
+
+  argint(0, &n);
+  acquire(&mm->lock);
+  old = mm->memlimit;
+  if(n <= 0 || (old != 0 && n > old)){
+    release(&mm->lock);
+    return -1;
+  }
+  mm->memlimit = n;
+  release(&mm->lock);
+  return old;
 }
@@ -0,0 +1,168 @@
+//
+// Timekeeping: the scheduler tick, and sleeping until a time.
+//
+// the time CSR counts at timebase Hz on every hart, whether or
+// not the hart takes timer interrupts, so uptime is read from
+// it rather than counted. a hart asks for a timer interrupt
+// with stimecmp only when it needs one:
+//
+//  - every TICK while it runs a process, which schedtick() may
+//    preempt;
+//  - at the earliest deadline of any sleeping process.
+//
+// so an idle hart with no sleepers to wake takes no timer
+// interrupts at all. the hart that adds a deadline programs
+// its own timer for it when it next calls timerarm(), in
+// scheduler(); every later timerarm() includes the earliest
+// deadline, so some hart's timer stays armed for it.
+//
+// only an interrupt at or after the hart's next tick counts
+// for schedtick(); one taken early for a deadline does not
+// shorten the running process's slice.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+// time CSR counts per second. fdtinit() reads the machine's
+// from the device tree.
+uint64 timebase = TIMEBASE;
+
+#define TICK (timebase / HZ)
+#define NEVER (~0UL)
+
+// a process sleeping until the time CSR reaches deadline.
+struct timer {
+  uint64 deadline;
+  int fired;
+  struct timer *next;
+};
+
+struct spinlock tickslock;      // guards timers and nextdeadline
+static struct timer *timers;    // sorted by deadline
+static uint64 nextdeadline = NEVER;
+static uint64 nexttick[NCPU];   // each hart's, NEVER when idle
+
+void
+clockinit(void)
+{
+  initlock(&tickslock, "time");
+}
+
+// Ticks since boot.
+uint
+uptime(void)
+{
+  return r_time() / TICK;
+}
+
+// Microseconds since boot.
+uint64
+uptimeus(void)
+{
+  uint64 t = r_time();
+
+  return (t / timebase) * 1000000 + (t % timebase) * 1000000 / timebase;
+}
+
+// Convert microseconds to time CSR counts.
+uint64
+ustotime(uint64 us)
+{
+  return (us / 1000000) * timebase + (us % 1000000) * timebase / 1000000;
+}
+
+// Program this hart's timer for its next tick, or the earliest
+// sleeper's deadline if that comes first.
+static void
+timerset(int id)
+{
+  uint64 next = nexttick[id];
+  uint64 d = __atomic_load_n(&nextdeadline, __ATOMIC_RELAXED);
+
+  if(d < next)
+    next = d;
+  w_stimecmp(next);
+}
+
+// Start this hart's ticks afresh: a full tick from now if it
+// is about to run a process, none if busy == 0 and the hart is
+// going idle.
+void
+timerarm(int busy)
+{
+  int id = cpuid();
+
+  nexttick[id] = busy ? r_time() + TICK : NEVER;
+  timerset(id);
+}
+
+// A timer interrupt: wake the sleepers whose deadlines have
+// passed, and ask for the next interrupt. Returns 1 if a tick
+// has elapsed, 0 if the interrupt came only for a deadline.
+int
+clockintr(void)
+{
+  struct timer *t;
+  uint64 now = r_time();
+  int id = cpuid(), tick = 0;
+
+  acquire(&tickslock);
+  while((t = timers) != 0 && t->deadline <= now){
+    timers = t->next;
+    t->fired = 1;
+    wakeup(t);
+  }
+  nextdeadline = timers ? timers->deadline : NEVER;
+  release(&tickslock);
+
+  if(mycpu()->proc == 0){
+    nexttick[id] = NEVER;
+  } else if(now >= nexttick[id]){
+    nexttick[id] = now + TICK;
+    tick = 1;
+  }
+  timerset(id);
+  return tick;
+}
+
+// Sleep until the time CSR reaches deadline.
+// Returns 0, or -1 if the process was killed first.
+int
+sleepuntil(uint64 deadline)
+{
+  struct timer t, **pp;
+  int r = 0;
+
+  if(r_time() >= deadline)
+    return 0;
+  acquire(&tickslock);
+  t.deadline = deadline;
+  t.fired = 0;
+  for(pp = &timers; *pp && (*pp)->deadline <= deadline; pp = &(*pp)->next)
+    ;
+  t.next = *pp;
+  *pp = &t;
+  if(deadline < nextdeadline)
+    nextdeadline = deadline;
+
+  while(!t.fired){
+    if(killed(myproc())){
+      // still queued, since it has not fired.
+      for(pp = &timers; *pp != &t; pp = &(*pp)->next)
+        ;
+      *pp = t.next;
+      nextdeadline = timers ? timers->deadline : NEVER;
+      r = -1;
+      break;
+    }
+    sleep(&t, &tickslock);
+  }
+  release(&tickslock);
+  return r;
+}
@@ -14,16 +14,8 @@ extern void kernelvec();
 extern void uservec();
 extern void usertrapret();
 
-struct spinlock tickslock;
-uint ticks;
 int devintr(void); 
 
-void
-trapinit(void)
-{
-  initlock(&tickslock, "time");
-}
-
 void
 trapinithart(void)
 {
@@ -46,8 +38,8 @@ usertrap(void)
 
   switch (scause) {
   case 8: // system call
-    if (p->killed)
-      panic("some error message"); 
+    if (killed(p))
+      kexit(-1);
     p->trapframe->epc += 4;
     intr_on();
     syscall();
@@ -57,19 +49,21 @@ usertrap(void)
   case 15: // page fault on store
   {
     uint64 va = r_stval();
-    uint64 mem = vmfault(p->pagetable, va, scause == 15);
+    uint64 mem = vmfault(p->mm->pagetable, va, scause == 13);
     if (mem == 0) {
       printf("pid %d %s: access fault va 0x%p\n", p->pid,
              scause == 15 ? "store" : "load", (void*)va);
-      p->killed = 1;
+      setkilled(p);
     }
     break;
   }
 
   case 2: // illegal instruction
+    if (vecfault(p))
+      break;  // first vector instruction; retry it with V on
     printf("pid %d %s: illegal instruction at 0x%p\n", p->pid,
            p->name, (void *)r_sepc());
-    p->killed = 1;
+    setkilled(p);
     break;
 
   default:
@@ -77,16 +71,16 @@ usertrap(void)
     if (which_dev == 0) {
       printf("usertrap(): unexpected scause %p pid=%d\n", (void *)scause, p->pid);
       printf("sepc=%p stval=%p\n", (void *)r_sepc(), (void *)r_stval());
-      p->killed = 1;
+      setkilled(p);
     }
     break;
   }
 
-  if (p->killed)
-     panic("some error message");
+  if (killed(p))
+    kexit(-1);
 
   // Give up the CPU if needed
-  if (scause == 1 || scause == 5)
+  if (which_dev == 2 && schedtick())
     yield();
 
   usertrapret();
@@ -98,20 +92,57 @@ usertrapret(void)
 {
   struct proc *p = myproc();
 
+  // we're about to switch the destination of traps from
+  // kerneltrap() to usertrap(), so turn off interrupts until
+  // we're back in user space, where usertrap() is correct.
   intr_off();
 
-  // Set up trapframe values for uservec
+  // the process's vector registers, if it uses them.
+  vecreturn(p);
+
+  w_stvec(TRAMPOLINE + ((void *)uservec - (void *)trampoline));
+
+  // set up trapframe values that uservec will need when
+  // the process next traps into the kernel.
+  p->trapframe->kernel_satp = r_satp();         // kernel page table
+  p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
+  p->trapframe->kernel_trap = (uint64)usertrap;
+  p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
+
+  // set up the registers that trampoline.S's sret will use
+  // to get to user space.
   uint64 x = r_sstatus();
   x &= ~SSTATUS_SPP; // clear SPP to go back to user mode
   x |= SSTATUS_SPIE; // enable interrupts
   w_sstatus(x);
   w_sepc(p->trapframe->epc);
 
-  w_stvec(TRAMPOLINE + ((void *)uservec - (void *)trampoline));
+  // tell userret which page table, and ASID, to switch to.
+  uint64 satp = uvmswitch(p);
 
-  // Switch to trampoline to return to user space
+  // jump to userret in trampoline.S at the top of memory, which
+  // switches to the user page table, restores user registers,
+  // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void(*)(void))fn)();
+  ((void (*)(uint64, uint64))fn)(satp, THREADFRAME(p->tslot));
+}
+
+// uaccess.S's table of user accesses that may fault.
+struct exentry {
+  uint64 insn;   // the load or store
+  uint64 fixup;  // where to continue if it faults
+};
+extern struct exentry ex_table[], ex_table_end[];
+
+// If the kernel faulted at pc on a user access, return
+// where to continue, else 0.
+static uint64
+exfixup(uint64 pc)
+{
+  for (struct exentry *e = ex_table; e < ex_table_end; e++)
+    if (e->insn == pc)
+      return e->fixup;
+  return 0;
 }
 
 // kernel trap
@@ -119,21 +150,41 @@ void
 kerneltrap()
 {
   int which_dev = 0;
+  uint64 sepc = r_sepc();
+  uint64 sstatus = r_sstatus();
+  uint64 scause = r_scause();
+  uint64 fixup;
 
-  if ((r_sstatus() & SSTATUS_SPP) == 0)
+  if ((sstatus & SSTATUS_SPP) == 0)
     panic("kerneltrap: not from supervisor mode");
 
+  // a page fault in copy_user() or strncpy_user().
+  if ((scause == 13 || scause == 15) && (fixup = exfixup(sepc)) != 0) {
+    w_sepc(fixup);
+    return;
+  }
+
   which_dev = devintr();
   if (which_dev == 0) {
-    printf("kerneltrap(): unexpected scause %p\n", (void *)r_scause());
+    printf("kerneltrap(): unexpected scause %p\n", (void *)scause);
+    printf("sepc=%p stval=%p\n", (void *)sepc, (void *)r_stval());
     panic("kerneltrap");
   }
 
-  if (which_dev == 2)
+  if (which_dev == 2 && myproc() != 0 && schedtick())
     yield();
+
+  // yield() may have caused some traps to occur,
+  // so restore trap registers for use by kernelvec.S's sret.
+  w_sepc(sepc);
+  w_sstatus(sstatus);
 }
 
-// check for device interrupt
+// check if it's an external interrupt, a timer interrupt,
+// or an IPI, and handle it.
+// returns 2 if a timer tick, 3 if IPI,
+// 1 if other device (or a timer interrupt for a sleeper's
+// deadline alone), 0 if not recognized.
 int
 devintr(void)
 {
@@ -149,16 +200,15 @@ devintr(void)
     if (irq)
       plic_complete(irq);
     return 1;
+  } else if (scause == 0x8000000000000005L) {
+    // timer interrupt. clockintr() asks for the next one,
+    // which also clears this one.
+    return clockintr() ? 2 : 1;
   } else if (scause == 0x8000000000000001L) {
-    // software timer interrupt
-    if (cpuid() == 0) {
-      acquire(&tickslock);
-      ticks++;
-      wakeup(&ticks);
-      release(&tickslock);
-    }
+    // software interrupt: an IPI from another hart (ipi.c).
     w_sip(r_sip() & ~2);
-    return 2;
+    ipiintr();
+    return 3;
   } else {
     return 0;
   }
@@ -0,0 +1,363 @@
+//
+// Support for the RISC-V vector extension, with make RVV=1.
+//
+// The kernel uses vector.S's versions of copy_page(),
+// clear_page(), memcmp() and checksum() when the hart has V.
+// User processes may use vector instructions as well; their
+// vector registers are handled lazily:
+//
+//  - a process starts with sstatus.VS off, so its first vector
+//    instruction traps; vecfault() then gives it a struct vstate.
+//  - a process's registers stay in the hardware across traps and
+//    are saved only when the hart switches away from the process
+//    with them dirty, or when the kernel wants the registers.
+//  - on the way back to user space, vecreturn() reloads them only
+//    if something else has used the registers in the meantime.
+//
+// cpu->vowner and proc->vcpu record whose registers a hart holds.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "memstat.h"
+#include "defs.h"
+
+#ifdef RVV
+
+// a process's saved vector state, in one page.
+struct vstate {
+  uint64 vl;
+  uint64 vtype;
+  uint64 vstart;
+  uint64 vcsr;
+  uint64 pad[4];
+  uchar v[];      // v0-v31, vlenb bytes each; see vsave in vector.S
+};
+
+void vcopy_page(void*, const void*);
+void vclear_page(void*);
+int vmemcmp(const void*, const void*, uint64);
+uint32 vchecksum(const void*, uint64);
+void vsave(struct vstate*);
+void vrestore(struct vstate*);
+
+static int vector;       // does this machine have V?
+static uint64 vlenb;     // bytes in a vector register
+
+// below this, starting up the vector unit costs more than it saves.
+#define VMEMCMP_MIN 256
+
+static inline uint64
+r_vlenb(void)
+{
+  uint64 x;
+  asm volatile("csrr %0, vlenb" : "=r" (x) );
+  return x;
+}
+
+static inline int
+vsdirty(void)
+{
+  return (r_sstatus() & SSTATUS_VS) == SSTATUS_VS_DIRTY;
+}
+
+// Find out whether the hart implements V: if it doesn't,
+// sstatus.VS reads as zero whatever is written to it.
+void
+vecinit(void)
+{
+  w_sstatus(r_sstatus() | SSTATUS_VS_INITIAL);
+  if((r_sstatus() & SSTATUS_VS) == 0)
+    return;
+  vlenb = r_vlenb();
+  w_sstatus(r_sstatus() & ~SSTATUS_VS);
+  if(sizeof(struct vstate) + 32*vlenb > PGSIZE){
+    printf("vector: vlenb %ld too large, not using V\n", vlenb);
+    return;
+  }
+  vector = 1;
+  printf("vector: VLEN %ld\n", vlenb * 8);
+}
+
+// Take the vector registers for the kernel's own use,
+// saving the state of the process that holds them if needed.
+// interrupts stay off until kvecend().
+static void
+kvecbegin(void)
+{
+  struct cpu *c;
+
+  push_off();
+  c = mycpu();
+  if(c->vowner){
+    if(vsdirty())
+      vsave(c->vowner->vstate);
+    c->vowner = 0;
+  }
+  w_sstatus(r_sstatus() | SSTATUS_VS_DIRTY);
+}
+
+static void
+kvecend(void)
+{
+  pop_off();
+}
+
+// A user illegal-instruction trap. If it was p's first vector
+// instruction, give p a vector state and return 1; the
+// instruction is retried once vecreturn() has enabled V.
+int
+vecfault(struct proc *p)
+{
+  uint64 op = r_stval() & 0x7f;   // the instruction, if recorded
+  char *mem;
+
+  if(!vector || p->vstate || (r_sstatus() & SSTATUS_VS) != 0)
+    return 0;
+  // OP-V, vector loads and stores, and vector CSR accesses.
+  if(op != 0 && op != 0x57 && op != 0x07 && op != 0x27 && op != 0x73)
+    return 0;
+  if((mem = kalloctype(KMEM_KERNEL)) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+  p->vstate = (struct vstate *)mem;
+  p->vcpu = -1;
+  return 1;
+}
+
+// Save p's vector registers if it is switching out of this
+// hart with them dirty, so that it can run on another hart.
+// Called by sched(), with interrupts off.
+void
+vecswitch(struct proc *p)
+{
+  struct cpu *c = mycpu();
+
+  if(c->vowner == p && vsdirty()){
+    vsave(p->vstate);
+    w_sstatus((r_sstatus() & ~SSTATUS_VS) | SSTATUS_VS_CLEAN);
+  }
+}
+
+// Set sstatus.VS for running p in user space, first reloading
+// p's vector registers if this hart's aren't p's latest.
+// Called by usertrapret(), with interrupts off.
+void
+vecreturn(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  uint64 x = r_sstatus() & ~SSTATUS_VS;
+
+  if(p->vstate == 0){
+    w_sstatus(x);   // off, so the first use traps
+    return;
+  }
+  if(c->vowner != p || p->vcpu != cpuid()){
+    w_sstatus(x | SSTATUS_VS_CLEAN);
+    vrestore(p->vstate);
+    c->vowner = p;
+    p->vcpu = cpuid();
+    w_sstatus(x | SSTATUS_VS_CLEAN);
+  } else if((r_sstatus() & SSTATUS_VS) == 0){
+    // a process without vector state ran here since; the
+    // registers are still p's.
+    w_sstatus(x | SSTATUS_VS_CLEAN);
+  }
+}
+
+// Copy p's vector state to child np, for fork().
+int
+veccopy(struct proc *p, struct proc *np)
+{
+  char *mem;
+
+  if(p->vstate == 0)
+    return 0;
+  if((mem = kalloctype(KMEM_KERNEL)) == 0)
+    return -1;
+  push_off();
+  if(mycpu()->vowner == p && p->vcpu == cpuid() && vsdirty()){
+    vsave(p->vstate);
+    w_sstatus((r_sstatus() & ~SSTATUS_VS) | SSTATUS_VS_CLEAN);
+  }
+  pop_off();
+  memmove(mem, p->vstate, PGSIZE);
+  np->vstate = (struct vstate *)mem;
+  np->vcpu = -1;
+  return 0;
+}
+
+// Drop p's vector state, for exec() and freeproc(). if this
+// hart holds p's registers, forget them and turn V off, so
+// that vecswitch() does not save them into the freed state.
+void
+vecfree(struct proc *p)
+{
+  push_off();
+  if(mycpu()->vowner == p){
+    mycpu()->vowner = 0;
+    w_sstatus(r_sstatus() & ~SSTATUS_VS);
+  }
+  pop_off();
+  if(p->vstate)
+    kfree(p->vstate);
+  p->vstate = 0;
+  p->vcpu = -1;
+}
+
+void
+copy_page(void *dst, const void *src)
+{
+  if(!vector){
+    scalar_copy_page(dst, src);
+    return;
+  }
+  kvecbegin();
+  vcopy_page(dst, src);
+  kvecend();
+}
+
+void
+clear_page(void *dst)
+{
+  if(!vector){
+    scalar_clear_page(dst);
+    return;
+  }
+  kvecbegin();
+  vclear_page(dst);
+  kvecend();
+}
+
+int
+memcmp(const void *v1, const void *v2, uint n)
+{
+  int r;
+
+  if(!vector || n < VMEMCMP_MIN)
+    return scalar_memcmp(v1, v2, n);
+  kvecbegin();
+  r = vmemcmp(v1, v2, n);
+  kvecend();
+  return r;
+}
+
+uint32
+checksum(const void *p, uint n)
+{
+  uint32 sum;
+
+  if(!vector)
+    return scalar_checksum(p, n);
+  kvecbegin();
+  sum = vchecksum(p, n / 4);
+  kvecend();
+  return sum;
+}
+
+#ifdef VECBENCH
+#define NBENCH 2000
+
+// Time the scalar and vector versions of each routine on a
+// couple of pages, and print ticks of the time CSR per call.
+// make RVV=1 VECBENCH=1 runs it once at boot.
+void
+vecbench(void)
+{
+  char *a = kalloc(), *b = kalloc();
+  uint64 t0, t1, t2;
+  volatile int r = 0;
+
+  if(a == 0 || b == 0 || !vector)
+    panic("vecbench");
+  memset(a, 7, PGSIZE);
+  memset(b, 7, PGSIZE);
+
+  printf("vecbench: %d calls, time ticks scalar/vector\n", NBENCH);
+
+  t0 = r_time();
+  for(int i = 0; i < NBENCH; i++)
+    scalar_copy_page(b, a);
+  t1 = r_time();
+  for(int i = 0; i < NBENCH; i++)
+    copy_page(b, a);
+  t2 = r_time();
+  printf("  copy_page  %ld / %ld\n", t1 - t0, t2 - t1);
+
+  t0 = r_time();
+  for(int i = 0; i < NBENCH; i++)
+    scalar_clear_page(b);
+  t1 = r_time();
+  for(int i = 0; i < NBENCH; i++)
+    clear_page(b);
+  t2 = r_time();
+  printf("  clear_page %ld / %ld\n", t1 - t0, t2 - t1);
+
+  memset(b, 7, PGSIZE);
+  t0 = r_time();
+  for(int i = 0; i < NBENCH; i++)
+    r += scalar_memcmp(a, b, PGSIZE);
+  t1 = r_time();
+  for(int i = 0; i < NBENCH; i++)
+    r += memcmp(a, b, PGSIZE);
+  t2 = r_time();
+  printf("  memcmp     %ld / %ld\n", t1 - t0, t2 - t1);
+
+  t0 = r_time();
+  for(int i = 0; i < NBENCH; i++)
+    r += scalar_checksum(a, PGSIZE);
+  t1 = r_time();
+  for(int i = 0; i < NBENCH; i++)
+    r += checksum(a, PGSIZE);
+  t2 = r_time();
+  printf("  checksum   %ld / %ld\n", t1 - t0, t2 - t1);
+
+  if(scalar_checksum(a, PGSIZE) != checksum(a, PGSIZE))
+    panic("vecbench: checksum");
+  kfree(a);
+  kfree(b);
+}
+#endif // VECBENCH
+
+#else // RVV
+
+// without RVV, user vector instructions are illegal and the
+// kernel uses string.c's routines.
+
+void
+vecinit(void)
+{
+}
+
+int
+vecfault(struct proc *p)
+{
+  return 0;
+}
+
+void
+vecswitch(struct proc *p)
+{
+}
+
+void
+vecreturn(struct proc *p)
+{
+}
+
+int
+veccopy(struct proc *p, struct proc *np)
+{
+  return 0;
+}
+
+void
+vecfree(struct proc *p)
+{
+}
+
+#endif // RVV
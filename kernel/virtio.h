@@ -45,9 +45,11 @@
 #define VIRTIO_RING_F_INDIRECT_DESC 28
 #define VIRTIO_RING_F_EVENT_IDX     29
 
-// this many virtio descriptors.
+// this many virtio descriptors. a request takes two plus one
+// per block, so that seven requests of MAXIOBLOCKS blocks, or
+// 42 of one block, can be in flight at once.
 // must be a power of two.
-#define NUM 8
+#define NUM 128
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -4,6 +4,13 @@
 //
 // qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0
 //
+// virtio_disk_startv() queues a request for a run of up to
+// MAXIOBLOCKS consecutive blocks and returns at once, so that
+// many can be in flight; virtio_disk_intr() calls each buf's
+// iodone() as its request completes, or wakes a process
+// waiting in virtio_disk_wait(). virtio_disk_rw() does one
+// block and waits.
+//
 
 #include "types.h"
 #include "riscv.h"
@@ -46,7 +53,8 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b[MAXIOBLOCKS];
+    int n;
     char status;
   } info[NUM];
 
@@ -196,12 +204,11 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -212,27 +219,36 @@ alloc3_desc(int *idx)
   return 0;
 }
 
+// Queue one request to read or write the n (at most
+// MAXIOBLOCKS) bufs in bs, which hold consecutive blocks, and
+// return without waiting for it. when the disk is done,
+// virtio_disk_intr() calls each buf's iodone(), from the
+// interrupt, if it is set.
 void
-virtio_disk_rw(struct buf *b, int write)
+virtio_disk_startv(struct buf **bs, int n, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  uint64 sector = bs[0]->blockno * (BSIZE / 512);
+
+  if(n < 1 || n > MAXIOBLOCKS)
+    panic("virtio_disk_startv");
 
   acquire(&disk.vdisk_lock);
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // a descriptor for type/reserved/sector, then descriptors for
+  // the data, then one for a 1-byte status result. the data
+  // descriptors scatter the request's blocks over the bufs.
 
-  // allocate the three descriptors.
-  int idx[3];
+  // allocate n+2 descriptors.
+  int idx[MAXIOBLOCKS+2];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc_descs(idx, n+2) == 0) {
       break;
     }
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -249,24 +265,30 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(int i = 0; i < n; i++){
+    struct virtq_desc *d = &disk.desc[idx[i+1]];
+    d->addr = (uint64) bs[i]->data;
+    d->len = BSIZE;
+    if(write)
+      d->flags = 0; // device reads b->data
+    else
+      d->flags = VRING_DESC_F_WRITE; // device writes b->data
+    d->flags |= VRING_DESC_F_NEXT;
+    d->next = idx[i+2];
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
-
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
+
+  // record the bufs for virtio_disk_intr().
+  for(int i = 0; i < n; i++){
+    bs[i]->disk = 1;
+    disk.info[idx[0]].b[i] = bs[i];
+  }
+  disk.info[idx[0]].n = n;
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -280,17 +302,35 @@ virtio_disk_rw(struct buf *b, int write)
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
-  // Wait for virtio_disk_intr() to say request has finished.
+  release(&disk.vdisk_lock);
+}
+
+// Queue a request to read or write b alone.
+void
+virtio_disk_start(struct buf *b, int write)
+{
+  virtio_disk_startv(&b, 1, write);
+}
+
+// Wait for a request started without an iodone() to finish.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
-
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  b->iodone = 0;
+  virtio_disk_start(b, write);
+  virtio_disk_wait(b);
+}
+
 void
 virtio_disk_intr()
 {
@@ -316,11 +356,27 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
-
+    struct buf *bs[MAXIOBLOCKS];
+    int n = disk.info[id].n;
+    for(int i = 0; i < n; i++){
+      bs[i] = disk.info[id].b[i];
+      disk.info[id].b[i] = 0;
+    }
+    free_chain(id);
     disk.used_idx += 1;
+
+    for(int i = 0; i < n; i++){
+      struct buf *b = bs[i];
+      b->disk = 0;   // disk is done with buf
+      if(b->iodone){
+        // without the lock, so that iodone() may start more.
+        release(&disk.vdisk_lock);
+        b->iodone(b);
+        acquire(&disk.vdisk_lock);
+      } else {
+        wakeup(b);
+      }
+    }
   }
 
   release(&disk.vdisk_lock);
@@ -7,12 +7,33 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "fs.h"
+#include "memstat.h"
+#include "vm.h"
 
 /*
  * the kernel's page table.
  */
 pagetable_t kernel_pagetable;
 
+/*
+ * address-space IDs. each address space is given an ASID
+ * from a counter the first time it runs; ASIDs are not reused
+ * within a generation, so a hart's TLB can keep the entries of
+ * several processes across context switches. when the counter
+ * runs out a new generation starts: every hart flushes its whole
+ * TLB before it next enters user space, and address spaces are
+ * given fresh ASIDs as they next run.
+ *
+ * ASIDs are handed out in pairs: asid tags the user page table,
+ * asid+1 the matching kernel page table (see uaccess()).
+ */
+struct {
+  struct spinlock lock;
+  uint64 gen;   // current generation, from 1
+  uint64 next;  // next free ASID in this generation
+  uint64 max;   // largest ASID satp supports; 0 if none
+} asids;
+
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 extern char trampoline[]; // trampoline.S
 
@@ -24,19 +45,19 @@ int ismapped(pagetable_t pagetable, uint64 va);
 pagetable_t
 kvmmake(void)
 {
-  pagetable_t kpgtbl = (pagetable_t)kalloc();
+  pagetable_t kpgtbl = (pagetable_t)kalloctype(KMEM_PGTBL);
   if (!kpgtbl)
     panic("kvmmake: out of memory");
-  memset(kpgtbl, 0, PGSIZE);
+  clear_page(kpgtbl);
 
+  kvmmap(kpgtbl, CLINT, CLINT, PGSIZE, PTE_R | PTE_W);
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
   kvmmap(kpgtbl, PLIC, PLIC, 0x4000000, PTE_R | PTE_W);
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
-  kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
+  kvmmapmega(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
   kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 
-  proc_mapstacks(kpgtbl);
   return kpgtbl;
 }
 
@@ -47,20 +68,302 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
     panic("kvmmap");
 }
 
+// Like kvmmap(), but use 2-megabyte level-1 leaf PTEs wherever
+// va and pa are both suitably aligned, so that direct-mapping a
+// large RAM costs only a few page-table pages.
+void
+kvmmapmega(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
+{
+  uint64 last = va + sz;
+
+  while (va < last) {
+    if (va % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 && last - va >= MEGAPGSIZE) {
+      pte_t *pte = &kpgtbl[PX(2, va)];
+      pagetable_t l1;
+      if (*pte & PTE_V) {
+        l1 = (pagetable_t)PTE2PA(*pte);
+      } else {
+        if ((l1 = (pagetable_t)kalloctype(KMEM_PGTBL)) == 0)
+          panic("kvmmapmega: out of memory");
+        clear_page(l1);
+        *pte = PA2PTE(l1) | PTE_V;
+      }
+      pte = &l1[PX(1, va)];
+      if (*pte & PTE_V)
+        panic("kvmmapmega: remap");
+      *pte = PA2PTE(pa) | perm | PTE_V;
+      va += MEGAPGSIZE;
+      pa += MEGAPGSIZE;
+    } else {
+      kvmmap(kpgtbl, va, pa, PGSIZE, perm);
+      va += PGSIZE;
+      pa += PGSIZE;
+    }
+  }
+}
+
 void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  initlock(&asids.lock, "asid");
+  asids.gen = 1;
+  asids.next = 1;   // ASID 0 is the kernel's
 }
 
 void
 kvminithart(void)
 {
   sfence_vma();
+  if (cpuid() == 0) {
+    // satp's ASID field holds only as many bits as the hardware
+    // implements; write all ones and see which stick.
+    w_satp(MAKE_SATP_ASID(kernel_pagetable, SATP_ASID_MASK));
+    asids.max = SATP_ASID(r_satp());
+    if (asids.max < 2)
+      asids.max = 0;  // too few to hand out in pairs
+  }
   w_satp(MAKE_SATP(kernel_pagetable));
   sfence_vma();
 }
 
+// Give mm a pair of ASIDs if it has none in the current
+// generation, and flush what this hart's TLB may hold that is
+// stale for mm. Called with interrupts off, before running on
+// either of mm's page tables.
+static void
+asidswitch(struct mm *mm)
+{
+  struct cpu *c = mycpu();
+  uint64 bit = 1L << cpuid();
+  uint64 gen, stale;
+
+  acquire(&asids.lock);
+  if (mm->asidgen != asids.gen) {
+    if (asids.next + 1 > asids.max) {
+      asids.gen++;
+      asids.next = 1;
+    }
+    mm->asid = asids.next;
+    asids.next += 2;
+    mm->asidgen = asids.gen;
+    mm->tlbstale = 0;  // no TLB holds entries for new ASIDs
+  }
+  gen = asids.gen;
+  release(&asids.lock);
+
+  stale = __sync_fetch_and_and(&mm->tlbstale, ~bit) & bit;
+  if (c->asidgen != gen) {
+    // ASIDs of an older generation may have been handed out again.
+    sfence_vma();
+    c->asidgen = gen;
+  } else if (stale) {
+    // the page table changed since this hart last ran it
+    // (see uvmflush()).
+    tlbflush(mm->asid, 0, 0);
+  }
+}
+
+// Return the satp to run p in user space with.
+// Called with interrupts off, on the way to user space.
+uint64
+uvmswitch(struct proc *p)
+{
+  if (asids.max == 0)
+    return MAKE_SATP(p->mm->pagetable);  // userret flushes the TLB
+  asidswitch(p->mm);
+  return MAKE_SATP_ASID(p->mm->pagetable, p->mm->asid);
+}
+
+// Flush TLB entries for npages of mm from va, or all of them if
+// npages is 0, after their PTEs changed. this hart flushes its
+// own TLB, and the other harts running mm right now, threads of
+// the same process, are sent one IPI each. other harts flush
+// when they next switch to mm (asidswitch()); without ASIDs they
+// flush on every entry to user space anyway.
+void
+uvmflush(struct mm *mm, uint64 va, uint64 npages)
+{
+  uint64 running = 0, asid = 0;
+  int id;
+
+  if (asids.max && mm->asidgen == 0)
+    return;  // mm has never run, so no TLB holds its entries
+  if (npages > 32)
+    npages = 0;  // cheaper to drop them all
+
+  push_off();
+  id = cpuid();
+  if (asids.max) {
+    asid = mm->asid;
+    // mark the other harts before looking for those running mm,
+    // so that one that starts to run mm meanwhile sees its mark.
+    __sync_fetch_and_or(&mm->tlbstale, ~(1L << id));
+    __sync_synchronize();
+    tlbflush(asid, va, npages);
+  }
+  for (int i = 0; i < NCPU; i++) {
+    struct proc *q = cpus[i].proc;
+    if (i != id && q && q->mm == mm)
+      running |= 1L << i;
+  }
+  if (running)
+    tlbshootdown(running, asid, va, npages);
+  pop_off();
+}
+
+/*
+ * a tlbgather collects the pages that unmapping frees, so that
+ * they reach kfree() only after uvmflush() has made sure that no
+ * hart's TLB can still reach them, and so that a whole range
+ * costs one flush: tlbgather(), tlbunmap() for each changed PTE,
+ * then tlbfinish(). a page-table page is gathered too, since the
+ * page walker caches non-leaf entries.
+ */
+#define TLBBATCH (PGSIZE / sizeof(void*))
+
+void
+tlbgather(struct tlbgather *g, struct mm *mm)
+{
+  g->mm = mm;
+  g->start = MAXVA;
+  g->end = 0;
+  g->all = 0;
+  g->n = 0;
+  g->batch = 0;
+  g->nbatch = 0;
+}
+
+// Flush, then free everything gathered so far.
+static void
+tlbflushgather(struct tlbgather *g)
+{
+  void **b, **next;
+
+  if (g->start < g->end)
+    uvmflush(g->mm, g->start, g->all ? 0 : (g->end - g->start) / PGSIZE);
+  for (int i = 0; i < g->n; i++)
+    kfree(g->pages[i]);
+  for (b = g->batch; b; b = next) {
+    next = b[0];
+    for (int i = 1; i < g->nbatch; i++)
+      kfree(b[i]);
+    kfree(b);
+    g->nbatch = TLBBATCH;  // older batches are full
+  }
+  tlbgather(g, g->mm);
+}
+
+// Free pa once the TLBs are flushed.
+static void
+gatherpage(struct tlbgather *g, void *pa)
+{
+  void **b;
+
+  if (g->n < TLBGATHER) {
+    g->pages[g->n++] = pa;
+    return;
+  }
+  if (g->batch == 0 || g->nbatch == TLBBATCH) {
+    if ((b = (void**)kalloctype(KMEM_KERNEL)) == 0) {
+      // memory is short: flush now rather than gather more.
+      tlbflushgather(g);
+      kfree(pa);
+      return;
+    }
+    b[0] = g->batch;
+    g->batch = b;
+    g->nbatch = 1;
+  }
+  g->batch[g->nbatch++] = pa;
+}
+
+// Record that the PTE for va has changed, and that pa, if not
+// 0, was mapped there and is to be freed.
+void
+tlbunmap(struct tlbgather *g, uint64 va, void *pa)
+{
+  if (va < g->start)
+    g->start = va;
+  if (va + PGSIZE > g->end)
+    g->end = va + PGSIZE;
+  if (pa)
+    gatherpage(g, pa);
+}
+
+void
+tlbfinish(struct tlbgather *g)
+{
+  tlbflushgather(g);
+}
+
+/*
+ * each address space has a kernel page table that the kernel
+ * switches to while it copies to and from user memory
+ * (uaccess()). it is
+ * the kernel page table, plus the user mappings below UACCESSTOP
+ * so that loads and stores with SSTATUS_SUM set reach them
+ * directly. all but the first top-level entry are shared with
+ * kernel_pagetable; the first points to a private copy of
+ * the kernel's level-1 table for the devices, whose user part
+ * (entries below UACCESSTOP) mirrors the user page table's
+ * level-1 entries and so shares its level-0 tables.
+ */
+#define UACCESSTOP PLIC
+#define UACCESSCHUNK (4*PGSIZE)  // bytes copied per uaccess_begin()
+
+pagetable_t
+kvmcreate(void)
+{
+  pagetable_t kpt, l1;
+
+  if ((kpt = (pagetable_t)kalloctype(KMEM_PGTBL)) == 0)
+    return 0;
+  if ((l1 = (pagetable_t)kalloctype(KMEM_PGTBL)) == 0) {
+    kfree(kpt);
+    return 0;
+  }
+  copy_page(kpt, kernel_pagetable);
+  copy_page(l1, (void*)PTE2PA(kernel_pagetable[0]));
+  // kvmsync() fills in the user part; the CLINT, which lies
+  // there, is not needed while user mappings are in place.
+  memset(l1, 0, PX(1, UACCESSTOP) * sizeof(pte_t));
+  kpt[0] = PA2PTE(l1) | PTE_V;
+  return kpt;
+}
+
+// Free a page table made by kvmcreate(), but none of the
+// tables it shares.
+void
+kvmfree(pagetable_t kpt)
+{
+  kfree((void*)PTE2PA(kpt[0]));
+  kfree(kpt);
+}
+
+// Bring mm's kernel page table's view of user addresses
+// [va, va+len) up to date with its user page table.
+static void
+kvmsync(struct mm *mm, uint64 va, uint64 len)
+{
+  pagetable_t k1 = (pagetable_t)PTE2PA(mm->kpagetable[0]);
+  pagetable_t u1 = 0;
+  int changed = 0;
+
+  if (mm->pagetable[0] & PTE_V)
+    u1 = (pagetable_t)PTE2PA(mm->pagetable[0]);
+  for (uint64 i = PX(1, va); i <= PX(1, va + len - 1); i++) {
+    pte_t pte = u1 ? u1[i] : 0;
+    if (k1[i] != pte) {
+      changed |= k1[i] & PTE_V;
+      k1[i] = pte;
+    }
+  }
+  // a level-0 table was replaced; flush cached non-leaf entries.
+  if (changed)
+    sfence_vma_asid(asids.max ? mm->asid + 1 : 0);
+}
+
 // Walk the page table to get PTE pointer for va
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
@@ -73,9 +376,9 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
     if (*pte & PTE_V) {
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if (!alloc || (pagetable = (pagetable_t)kalloc()) == 0)
+      if (!alloc || (pagetable = (pagetable_t)kalloctype(KMEM_PGTBL)) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
+      clear_page(pagetable);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
@@ -126,29 +429,107 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 pagetable_t
 uvmcreate()
 {
-  pagetable_t pagetable = (pagetable_t)kalloc();
+  pagetable_t pagetable = (pagetable_t)kalloctype(KMEM_PGTBL);
   if (!pagetable)
     return 0;
-  memset(pagetable, 0, PGSIZE);
+  clear_page(pagetable);
   return pagetable;
 }
 
-void
+static int
+emptytable(pagetable_t pagetable)
+{
+  for (int i = 0; i < 512; i++)
+    if (pagetable[i] != 0)   // mapped, or PTE_GUARD
+      return 0;
+  return 1;
+}
+
+// Unmap [va, last) from pagetable, a page-table page at the
+// given level. Skips whole subtrees that are not present, and
+// frees lower-level page-table pages that end up empty. if g
+// is not 0, the pages are freed by way of g.
+// Returns the number of leaf pages that were mapped.
+static uint64
+unmaplevel(pagetable_t pagetable, int level, uint64 va, uint64 last, int do_free,
+           struct tlbgather *g)
+{
+  uint64 n = 0;
+  uint64 span = 1L << PXSHIFT(level); // bytes mapped by one PTE
+
+  while (va < last) {
+    pte_t *pte = &pagetable[PX(level, va)];
+    uint64 next = (va & ~(span - 1)) + span;
+    uint64 end = next < last ? next : last;
+
+    if (*pte & PTE_V) {
+      if (*pte & (PTE_R | PTE_W | PTE_X)) {
+        if (level != 0)
+          panic("uvmunmap: superpage");
+        void *pa = do_free ? (void*)PTE2PA(*pte) : 0;
+        *pte = 0;
+        if (g)
+          tlbunmap(g, va, pa);
+        else if (pa)
+          kfree(pa);
+        n++;
+      } else {
+        pagetable_t child = (pagetable_t)PTE2PA(*pte);
+        n += unmaplevel(child, level - 1, va, end, do_free, g);
+        // if the child's whole span was unmapped it is
+        // certainly empty; otherwise look.
+        if ((va % span == 0 && end == next) || emptytable(child)) {
+          *pte = 0;
+          if (g) {
+            g->all = 1;
+            tlbunmap(g, va, child);
+          } else {
+            kfree((void*)child);
+          }
+        }
+      }
+    } else if (*pte & PTE_GUARD) {
+      *pte = 0;
+    }
+    va = end;
+  }
+  return n;
+}
+
+// Remove npages of mappings starting from va, skipping any
+// that are not mapped. Optionally free the physical memory.
+// Page-table pages left empty are freed as well.
+// Returns the number of pages that were mapped.
+uint64
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
   if (va % PGSIZE != 0)
     panic("uvmunmap: not aligned");
+  if (va + npages * PGSIZE > MAXVA)
+    panic("uvmunmap: va");
 
-  for (uint64 a = va; a < va + npages * PGSIZE; a += PGSIZE) {
-    pte_t *pte = walk(pagetable, a, 0);
-    if (!pte || (*pte & PTE_V) == 0)
-      continue;
-    if (do_free) {
-      uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
-    }
-    *pte = 0;
-  }
+  return unmaplevel(pagetable, 2, va, va + npages * PGSIZE, do_free, 0);
+}
+
+// Like uvmunmap(pagetable, va, npages, 1) for mm's page table
+// while mm may be running, on this hart or others: the pages,
+// and page-table pages left empty, are freed once no TLB can
+// still reach them.
+uint64
+uvmunmaplive(struct mm *mm, uint64 va, uint64 npages)
+{
+  struct tlbgather g;
+  uint64 n;
+
+  if (va % PGSIZE != 0)
+    panic("uvmunmaplive: not aligned");
+  if (va + npages * PGSIZE > MAXVA)
+    panic("uvmunmaplive: va");
+
+  tlbgather(&g, mm);
+  n = unmaplevel(mm->pagetable, 2, va, va + npages * PGSIZE, 1, &g);
+  tlbfinish(&g);
+  return n;
 }
 
 uint64
@@ -162,12 +543,12 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for (a = oldsz; a < newsz; a += PGSIZE) {
-    mem = kalloc();
+    mem = kalloctype(KMEM_ANON);
     if (!mem) {
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
+    clear_page(mem);
     if (mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R | PTE_U | xperm) != 0) {
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -213,28 +594,134 @@ uvmfree(pagetable_t pagetable, uint64 sz)
   freewalk(pagetable);
 }
 
+// Install mm's kernel page table and allow the kernel to touch
+// user pages. interrupts stay off until uaccess_end(), so that
+// no driver runs with user mappings in place, the caller stays
+// on this hart, and other threads' unmaps wait for the copy to
+// finish before they free pages (tlbshootdown()).
+// returns the satp to restore.
+static uint64
+uaccess_begin(struct mm *mm, uint64 va, uint64 len)
+{
+  uint64 satp = r_satp();
+
+  push_off();
+  kvmsync(mm, va, len);
+  if (asids.max) {
+    asidswitch(mm);
+    w_satp(MAKE_SATP_ASID(mm->kpagetable, mm->asid + 1));
+  } else {
+    w_satp(MAKE_SATP(mm->kpagetable));
+    sfence_vma();  // other processes' user entries
+  }
+  w_sstatus(r_sstatus() | SSTATUS_SUM);
+  return satp;
+}
+
+static void
+uaccess_end(uint64 satp)
+{
+  w_sstatus(r_sstatus() & ~SSTATUS_SUM);
+  w_satp(satp);
+  pop_off();
+}
+
+// The current process's address space, if pagetable is its page
+// table, else 0 (as for exec()'s new page table, which no other
+// thread can see).
+static struct mm *
+curmm(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  if (p == 0 || p->mm == 0 || p->mm->pagetable != pagetable)
+    return 0;
+  return p->mm;
+}
+
+// The software copies hold mm->lock while they use a physical
+// page, so that another thread cannot unmap and free it meanwhile.
+static void
+mmlock(struct mm *mm)
+{
+  if (mm)
+    acquire(&mm->lock);
+}
+
+static void
+mmunlock(struct mm *mm)
+{
+  if (mm)
+    release(&mm->lock);
+}
+
+// Copy len bytes from src to dst, one of which is user address
+// uva in pagetable, with plain loads and stores rather than by
+// walking the page table. only the current process's addresses
+// below UACCESSTOP can be reached this way. returns how many
+// bytes were copied; the caller copies the rest in software,
+// which also handles faults on pages not yet allocated.
+static uint64
+uaccess(pagetable_t pagetable, char *dst, char *src, uint64 len, uint64 uva)
+{
+  struct mm *mm = curmm(pagetable);
+  uint64 satp, n, left;
+
+  if (mm == 0 || uva >= UACCESSTOP)
+    return 0;
+  if (len > UACCESSTOP - uva)
+    len = UACCESSTOP - uva;
+
+  // a chunk at a time, to bound how long interrupts are off.
+  for (n = 0; n < len; n += UACCESSCHUNK) {
+    uint64 m = len - n < UACCESSCHUNK ? len - n : UACCESSCHUNK;
+    satp = uaccess_begin(mm, uva + n, m);
+    left = copy_user(dst + n, src + n, m);
+    uaccess_end(satp);
+    if (left)
+      return n + m - left;
+  }
+  return len;
+}
+
 // Copy memory from kernel to user, handling lazy allocation
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
+  struct mm *mm = curmm(pagetable);
   uint64 n, va0, pa0;
   pte_t *pte;
+
+  n = uaccess(pagetable, (char *)dstva, src, len, dstva);
+  dstva += n;
+  src += n;
+  len -= n;
+
   while (len > 0) {
     va0 = PGROUNDDOWN(dstva);
     if (va0 >= MAXVA)
       return -1;
+    mmlock(mm);
     pa0 = walkaddr(pagetable, va0);
     if (pa0 == 0) {
-      if ((pa0 = vmfault(pagetable, va0, 0)) == 0)
+      mmunlock(mm);
+      if (vmfault(pagetable, va0, 0) == 0)
         return -1;
+      continue;  // look again, with the lock held
     }
     pte = walk(pagetable, va0, 0);
-    if ((*pte & PTE_W) == 0)
+    if ((*pte & PTE_W) == 0) {
+      mmunlock(mm);
       return -1;
+    }
+    // as the hardware would, so a shared mapping's page is
+    // written back to its file.
+    *pte |= PTE_D;
     n = PGSIZE - (dstva - va0);
     if (n > len)
       n = len;
     memmove((void *)(pa0 + (dstva - va0)), src, n);
+    mmunlock(mm);
     len -= n;
     src += n;
     dstva = va0 + PGSIZE;
@@ -242,22 +729,53 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
   return 0;
 }
 
+// Fault in the missing pages of the user buffer [va, va+len),
+// for fileread() and filewrite() to call before they lock the
+// file's inode: a fault on an mmap() of the same file would
+// otherwise have mmapfault() lock it again. stops at the first
+// page that cannot be faulted in, which the copy then reports.
+void
+uvmprefault(pagetable_t pagetable, uint64 va, uint64 len, int write)
+{
+  struct mm *mm = curmm(pagetable);
+  uint64 a, pa;
+
+  for (a = PGROUNDDOWN(va); a < va + len && a < MAXVA; a += PGSIZE) {
+    mmlock(mm);
+    pa = walkaddr(pagetable, a);
+    mmunlock(mm);
+    if (pa == 0 && vmfault(pagetable, a, !write) == 0)
+      break;
+  }
+}
+
 // Copy memory from user to kernel, handling lazy allocation
 int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
+  struct mm *mm = curmm(pagetable);
   uint64 n, va0, pa0;
+
+  n = uaccess(pagetable, dst, (char *)srcva, len, srcva);
+  dst += n;
+  srcva += n;
+  len -= n;
+
   while (len > 0) {
     va0 = PGROUNDDOWN(srcva);
+    mmlock(mm);
     pa0 = walkaddr(pagetable, va0);
     if (pa0 == 0) {
-      if ((pa0 = vmfault(pagetable, va0, 1)) == 0)
+      mmunlock(mm);
+      if (vmfault(pagetable, va0, 1) == 0)
         return -1;
+      continue;
     }
     n = PGSIZE - (srcva - va0);
     if (n > len)
       n = len;
     memmove(dst, (void *)(pa0 + (srcva - va0)), n);
+    mmunlock(mm);
     len -= n;
     dst += n;
     srcva = va0 + PGSIZE;
@@ -265,18 +783,48 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
   return 0;
 }
 
+// Copy a null-terminated string like copyinstr(), with uaccess().
+// Returns 0 or -1 as copyinstr() would, or 1 if the caller
+// must copy it in software instead.
+static int
+uaccessstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
+{
+  struct mm *mm = curmm(pagetable);
+  uint64 satp;
+  long n;
+
+  if (mm == 0 || srcva >= UACCESSTOP ||
+      max > UACCESSTOP - srcva || max > UACCESSCHUNK || max == 0)
+    return 1;
+  satp = uaccess_begin(mm, srcva, max);
+  n = strncpy_user(dst, (char *)srcva, max);
+  uaccess_end(satp);
+  if (n < 0)
+    return 1;  // faulted
+  return (uint64)n < max ? 0 : -1;
+}
+
 // Copy null-terminated string from user to kernel
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
+  struct mm *mm = curmm(pagetable);
   uint64 n, va0, pa0;
-  int got_null = 0;
+  int got_null = 0, r;
+
+  if ((r = uaccessstr(pagetable, dst, srcva, max)) <= 0)
+    return r;
 
   while (!got_null && max > 0) {
     va0 = PGROUNDDOWN(srcva);
+    mmlock(mm);
     pa0 = walkaddr(pagetable, va0);
-    if (pa0 == 0)
-      return -1;
+    if (pa0 == 0) {
+      mmunlock(mm);
+      if (vmfault(pagetable, va0, 1) == 0)
+        return -1;
+      continue;
+    }
     n = PGSIZE - (srcva - va0);
     if (n > max)
       n = max;
@@ -294,44 +842,95 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
       p++;
       dst++;
     }
+    mmunlock(mm);
     srcva = va0 + PGSIZE;
   }
   return got_null ? 0 : -1;
 }
 
-// Allocate and map a page on demand
+// Allocate and map a page on demand, either zero-filled
+// heap or a page of an mmap()ed file.
 uint64
 vmfault(pagetable_t pagetable, uint64 va, int read)
 {
-  struct proc *p = myproc();
-  if (va >= p->sz)
-    return 0;
+  struct mm *mm = curmm(pagetable);
+  char *mem = 0;
+
+  if (mm == 0)
+    return 0;   // not the current address space, e.g. exec()'s new one
+  acquire(&mm->lock);
+  if (va >= mm->sz) {
+    release(&mm->lock);
+    return mmapfault(mm, va, !read);
+  }
 
   va = PGROUNDDOWN(va);
-  if (ismapped(pagetable, va))
-    return 0;
-
-  char *mem = kalloc();
+  // another thread may have faulted the page in already.
+  if ((mem = (char*)mappedfor(pagetable, va, !read)) != 0 ||
+      ismapped(pagetable, va))
+    goto out;
+  if (memcharge(mm, 1) < 0)
+    goto out;
+
+  mem = kalloctype(KMEM_ANON);
   if (!mem)
-    return 0;
-  memset(mem, 0, PGSIZE);
+    goto out;
+  clear_page(mem);
 
   if (mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_W | PTE_U | PTE_R) != 0) {
     kfree(mem);
-    return 0;
+    mem = 0;
+    goto out;
   }
+  mm->rss++;
 
+out:
+  release(&mm->lock);
   return (uint64)mem;
 }
 
+// Account for npages more resident pages in mm. If that would
+// take mm over its memory limit, first reclaim its own clean
+// file pages, so a process that overruns its limit only hurts
+// itself. Returns 0 if mm may allocate them, -1 if not.
+// Called with mm->lock held.
+int
+memcharge(struct mm *mm, uint64 npages)
+{
+  if (mm->memlimit == 0 || mm->rss + npages <= mm->memlimit)
+    return 0;
+  mmapreclaim(mm, mm->rss + npages - mm->memlimit);
+  if (mm->rss + npages <= mm->memlimit)
+    return 0;
+  return -1;
+}
+
+// The physical address of user page va, if it is mapped for
+// reading or writing by user code, else 0.
+uint64
+mappedfor(pagetable_t pagetable, uint64 va, int write)
+{
+  pte_t *pte = walk(pagetable, va, 0);
+
+  if (pte == 0 || (*pte & (PTE_V | PTE_U)) != (PTE_V | PTE_U))
+    return 0;
+  if ((*pte & (write ? PTE_W : PTE_R)) == 0)
+    return 0;
+  return PTE2PA(*pte);
+}
+
+// Is va mapped, or a guard page?
 int
 ismapped(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte = walk(pagetable, va, 0);
-  return pte && (*pte & PTE_V);
+  return pte && (*pte & (PTE_V | PTE_GUARD));
 }
 
-// Mark a PTE invalid for user access.
+// Turn the page at va into a guard page: free it, and leave an
+// invalid PTE marked PTE_GUARD so that a fault there is not
+// mistaken for one on a lazily allocated page. the page must
+// not merely lose PTE_U, since uaccess() could still reach it.
 // Used to create a guard page (inaccessible page) at the bottom of the user stack.
 void
 uvmclear(pagetable_t pagetable, uint64 va)
@@ -339,57 +938,52 @@ uvmclear(pagetable_t pagetable, uint64 va)
   pte_t *pte;
   
   pte = walk(pagetable, va, 0);
-  if(pte == 0)
+  if(pte == 0 || (*pte & PTE_V) == 0)
     panic("uvmclear");
-  *pte &= ~PTE_U;  // Clear the user accessible bit
+  kfree((void*)PTE2PA(*pte));
+  *pte = PTE_GUARD;
 }
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
 // Copies both the page table and the physical memory.
-// Returns 0 on success, -1 on failure.
+// Returns the number of pages copied, or -1 on failure.
 // Frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
+  pte_t *pte, *npte;
   uint64 pa, i;
   uint flags;
   char *mem;
+  int n = 0;
 
   for(i = 0; i < sz; i += PGSIZE){
+    // lazily allocated pages may not be there yet.
     if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+      continue;
+    if(*pte & PTE_GUARD){
+      if((npte = walk(new, i, 1)) == 0)
+        goto err;
+      *npte = PTE_GUARD;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if((mem = kalloctype(KMEM_ANON)) == 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
+    copy_page(mem, (char*)pa);
     if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
       kfree(mem);
       goto err;
     }
+    n++;
   }
-  return 0;
+  return n;
 
  err:
   uvmunmap(new, 0, i / PGSIZE, 1);
   return -1;
 }
-
-// Prepare trapframe for returning to user space.
-// This is typically called from forkret() to set up
-// the initial user context after fork.
-// void
-// prepare_return(void)
-// {
-//   struct proc *p = myproc();
-  
-//   // Release the process lock acquired in scheduler()
-//   release(&p->lock);
-  
-//   // Return to user space via userret in trampoline.S
-//   usertrapret();
-// }
\ No newline at end of file
@@ -1,2 +1,16 @@
 #define SBRK_EAGER 1
 #define SBRK_LAZY  2
+
+// pages unmapped from an address space that may be in use on
+// other harts, held back from kfree() until every TLB that may
+// cache them has been flushed; see tlbgather() in vm.c.
+#define TLBGATHER 8
+struct tlbgather {
+  struct mm *mm;
+  uint64 start, end;  // range whose PTEs changed
+  int all;            // flush all of mm's entries, not the range
+  int n;              // pages[] in use
+  void *pages[TLBGATHER];
+  void **batch;       // more pages; batch[0] links to an older batch
+  int nbatch;         // batch[] in use, counting the link
+};
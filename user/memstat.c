@@ -0,0 +1,33 @@
+#include "kernel/types.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// print physical memory use, and the resident
+// set size of each pid given (default: this process).
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat st;
+  int i;
+
+  if(memstat(0, &st) < 0){
+    fprintf(2, "memstat: failed\n");
+    exit(1);
+  }
+  printf("total %lu free %lu used %lu pages\n", st.total, st.free, st.used);
+  printf("pgtbl %lu anon %lu file %lu kernel %lu\n",
+         st.bytype[KMEM_PGTBL], st.bytype[KMEM_ANON],
+         st.bytype[KMEM_FILE], st.bytype[KMEM_KERNEL]);
+  if(argc < 2){
+    printf("pid %d rss %lu\n", getpid(), st.rss);
+    exit(0);
+  }
+  for(i = 1; i < argc; i++){
+    if(memstat(atoi(argv[i]), &st) < 0)
+      printf("pid %s: no such process\n", argv[i]);
+    else
+      printf("pid %s rss %lu\n", argv[i], st.rss);
+  }
+  exit(0);
+}
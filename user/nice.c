@@ -0,0 +1,20 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// nice n command [args...]: run command with nice value n.
+int
+main(int argc, char **argv)
+{
+  if(argc < 3){
+    fprintf(2, "usage: nice n command [args...]\n");
+    exit(1);
+  }
+  if(setpriority(0, atoi(argv[1])) < 0){
+    fprintf(2, "nice: bad nice value %s\n", argv[1]);
+    exit(1);
+  }
+  exec(argv[2], argv + 2);
+  fprintf(2, "nice: exec %s failed\n", argv[2]);
+  exit(1);
+}
@@ -0,0 +1,69 @@
+#include "kernel/types.h"
+#include "user/user.h"
+
+// Test sched_setaffinity() and sched_getaffinity(): masks are
+// limited to running harts, an empty one is refused, a process
+// pinned to each hart in turn keeps running, and fork()
+// inherits the mask.
+
+int
+main()
+{
+  uint64 all, mask, pinned;
+  int pid, xstatus;
+
+  if(sched_getaffinity(0, &all) < 0 || all == 0){
+    printf("testaffinity: getaffinity failed\n");
+    exit(1);
+  }
+  if(sched_setaffinity(0, 0) != -1){
+    printf("testaffinity: empty mask accepted\n");
+    exit(1);
+  }
+  if(sched_setaffinity(0, ~all) != -1){
+    printf("testaffinity: mask of harts that are not running accepted\n");
+    exit(1);
+  }
+  if(sched_getaffinity(-1, &mask) != -1){
+    printf("testaffinity: getaffinity of no process succeeded\n");
+    exit(1);
+  }
+
+  for(int i = 0; i < 64; i++){
+    if((all & (1UL << i)) == 0)
+      continue;
+    if(sched_setaffinity(0, 1UL << i) < 0){
+      printf("testaffinity: setaffinity failed\n");
+      exit(1);
+    }
+    for(volatile int j = 0; j < 1000000; j++)
+      ;
+    if(sched_getaffinity(0, &mask) < 0 || mask != (1UL << i)){
+      printf("testaffinity: mask not set\n");
+      exit(1);
+    }
+  }
+
+  pinned = mask;
+  pid = fork();
+  if(pid < 0){
+    printf("testaffinity: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    if(sched_getaffinity(0, &mask) < 0 || mask != pinned)
+      exit(1);
+    exit(0);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("testaffinity: child did not inherit the mask\n");
+    exit(1);
+  }
+  if(sched_setaffinity(0, all) < 0){
+    printf("testaffinity: could not restore the mask\n");
+    exit(1);
+  }
+
+  printf("testaffinity: PASS\n");
+  exit(0);
+}
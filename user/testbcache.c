@@ -0,0 +1,127 @@
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// Test the buffer cache under parallel use: processes each
+// write a file of their own and read it back many times, while
+// also reading one shared file, so that blocks are found in the
+// cache and recycled for other blocks concurrently, that the
+// cache grows into free memory, and that one large read, which
+// the kernel fetches in multi-block disk requests, is right.
+
+#define NCHILD 4
+#define NBLOCK 40     // more than the static buffers
+#define NPASS 4
+#define BSZ 1024
+
+char buf[BSZ];
+char big[NBLOCK*BSZ];
+
+static void
+fill(char c, int i)
+{
+  memset(buf, c, BSZ);
+  buf[0] = i;
+}
+
+static int
+check(int fd, char c)
+{
+  for(int i = 0; i < NBLOCK; i++){
+    if(read(fd, buf, BSZ) != BSZ || buf[0] != (char)i || buf[1] != c ||
+       buf[BSZ-1] != c)
+      return -1;
+  }
+  return 0;
+}
+
+static void
+child(int id)
+{
+  char name[] = "bcfileX";
+  int fd;
+
+  name[6] = '0' + id;
+  if((fd = open(name, O_CREATE | O_RDWR)) < 0)
+    exit(1);
+  for(int i = 0; i < NBLOCK; i++){
+    fill('a' + id, i);
+    if(write(fd, buf, BSZ) != BSZ)
+      exit(1);
+  }
+  close(fd);
+  for(int pass = 0; pass < NPASS; pass++){
+    if((fd = open(name, O_RDONLY)) < 0 || check(fd, 'a' + id) < 0)
+      exit(1);
+    close(fd);
+    if((fd = open("bcshared", O_RDONLY)) < 0 || check(fd, 'S') < 0)
+      exit(1);
+    close(fd);
+  }
+  unlink(name);
+  exit(0);
+}
+
+int
+main()
+{
+  int fd, xstatus;
+  struct memstat st;
+
+  if((fd = open("bcshared", O_CREATE | O_RDWR)) < 0){
+    printf("testbcache: create failed\n");
+    exit(1);
+  }
+  for(int i = 0; i < NBLOCK; i++){
+    fill('S', i);
+    if(write(fd, buf, BSZ) != BSZ){
+      printf("testbcache: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+
+  for(int i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("testbcache: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      child(i);
+  }
+  for(int i = 0; i < NCHILD; i++)
+    if(wait(&xstatus) < 0 || xstatus != 0){
+      printf("testbcache: a child read back wrong data\n");
+      exit(1);
+    }
+
+  if((fd = open("bcshared", O_RDONLY)) < 0){
+    printf("testbcache: open failed\n");
+    exit(1);
+  }
+  if(read(fd, big, sizeof(big)) != sizeof(big)){
+    printf("testbcache: large read failed\n");
+    exit(1);
+  }
+  close(fd);
+  for(int i = 0; i < NBLOCK; i++)
+    if(big[i*BSZ] != (char)i || big[i*BSZ+1] != 'S' || big[i*BSZ+BSZ-1] != 'S'){
+      printf("testbcache: large read returned wrong data\n");
+      exit(1);
+    }
+
+  if(memstat(0, &st) < 0){
+    printf("testbcache: memstat failed\n");
+    exit(1);
+  }
+  if(st.bytype[KMEM_FILE] == 0){
+    printf("testbcache: buffer cache did not grow\n");
+    exit(1);
+  }
+
+  unlink("bcshared");
+  printf("testbcache: PASS\n");
+  exit(0);
+}
@@ -0,0 +1,149 @@
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// Test clone(): threads share memory and open files with the
+// process that made them, can be reaped with wait(), and
+// survive another thread unmapping memory while they run.
+
+#define NTHREAD 4
+#define NINCR 10000
+#define STACKSZ 4096
+
+volatile int counter;
+volatile int done[NTHREAD];
+volatile int sharedfd = -1;
+volatile int stop;
+
+// each thread gets its own page of stack from malloc.
+static void*
+stack(void)
+{
+  char *s = malloc(STACKSZ);
+  if(s == 0){
+    printf("testclone: malloc failed\n");
+    exit(1);
+  }
+  return s + STACKSZ;
+}
+
+static void
+incr(void *arg)
+{
+  int id = (int)(uint64)arg;
+
+  for(int i = 0; i < NINCR; i++)
+    __sync_fetch_and_add(&counter, 1);
+  done[id] = 1;
+  exit(0);
+}
+
+static void
+opener(void *arg)
+{
+  int fd = open("clonefile", O_CREATE | O_RDWR);
+  if(fd < 0 || write(fd, "thread", 6) != 6)
+    exit(1);
+  sharedfd = fd;
+  exit(0);
+}
+
+static void
+spinner(void *arg)
+{
+  volatile char *heap = arg;
+
+  while(!stop)
+    heap[0]++;
+  exit(0);
+}
+
+int
+main()
+{
+  int pid, xstatus;
+  char buf[8];
+
+  // threads increment a shared counter.
+  for(int i = 0; i < NTHREAD; i++)
+    if(clone(incr, (void*)(uint64)i, stack()) < 0){
+      printf("testclone: clone failed\n");
+      exit(1);
+    }
+  for(int i = 0; i < NTHREAD; i++){
+    if(wait(&xstatus) < 0 || xstatus != 0){
+      printf("testclone: wait for thread failed\n");
+      exit(1);
+    }
+  }
+  for(int i = 0; i < NTHREAD; i++)
+    if(!done[i]){
+      printf("testclone: thread did not run\n");
+      exit(1);
+    }
+  if(counter != NTHREAD * NINCR){
+    printf("testclone: lost increments\n");
+    exit(1);
+  }
+
+  // a file a thread opens is open in its creator too.
+  if((pid = clone(opener, 0, stack())) < 0){
+    printf("testclone: clone failed\n");
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("testclone: opener thread failed\n");
+    unlink("clonefile");
+    exit(1);
+  }
+  if(sharedfd < 0){
+    printf("testclone: opener thread did not open\n");
+    unlink("clonefile");
+    exit(1);
+  }
+  if(close(sharedfd) < 0){
+    printf("testclone: thread's fd is not open in its creator\n");
+    unlink("clonefile");
+    exit(1);
+  }
+  int fd = open("clonefile", O_RDONLY);
+  if(fd < 0 || read(fd, buf, 6) != 6 || memcmp(buf, "thread", 6) != 0){
+    printf("testclone: thread's write is missing\n");
+    unlink("clonefile");
+    exit(1);
+  }
+  close(fd);
+  unlink("clonefile");
+
+  // unmap memory another thread is not using while it runs.
+  char *heap = sbrk(2 * 4096);
+  if(heap == (char*)-1){
+    printf("testclone: sbrk failed\n");
+    exit(1);
+  }
+  if((pid = clone(spinner, heap, stack())) < 0){
+    printf("testclone: clone failed\n");
+    exit(1);
+  }
+  for(int i = 0; i < 100; i++){
+    if(sbrk(-4096) == (char*)-1 || sbrk(4096) == (char*)-1){
+      printf("testclone: sbrk in parent failed\n");
+      exit(1);
+    }
+    heap[4096] = i;
+  }
+  stop = 1;
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("testclone: spinner thread failed\n");
+    exit(1);
+  }
+
+  // a badly aligned stack is refused.
+  if(clone(incr, 0, (char*)stack() - 8) >= 0){
+    printf("testclone: clone with misaligned stack succeeded\n");
+    exit(1);
+  }
+
+  printf("testclone: PASS\n");
+  exit(0);
+}
@@ -0,0 +1,149 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// Test the directory entry cache: lookups see names unlinked
+// and created again, in files and directories, while other
+// processes look the same paths up in parallel.
+
+#define NCHILD 4
+#define NROUND 200
+
+static void
+clean(void)
+{
+  unlink("dcd/sub/f");
+  unlink("dcd/sub");
+  unlink("dcd/f");
+  unlink("dcd");
+}
+
+// Look dcd/f up over and over; it comes and goes, but when it
+// opens it must hold one of the writer's rounds.
+static void
+looker(void)
+{
+  char buf[4];
+  struct stat st;
+
+  for(int i = 0; i < NROUND * 4; i++){
+    int fd = open("dcd/f", O_RDONLY);
+    if(fd >= 0){
+      if(fstat(fd, &st) < 0 || st.type != T_FILE)
+        exit(1);
+      if(st.size != 0 && (read(fd, buf, 1) != 1 || buf[0] != 'x'))
+        exit(1);
+      close(fd);
+    }
+    if(stat("dcd/sub/../f", &st) == 0 && st.type != T_FILE)
+      exit(1);
+  }
+  exit(0);
+}
+
+int
+main()
+{
+  struct stat st, st2;
+  int fd, xstatus;
+
+  clean();
+  if(mkdir("dcd") < 0 || mkdir("dcd/sub") < 0){
+    printf("testdcache: mkdir failed\n");
+    exit(1);
+  }
+  if((fd = open("dcd/f", O_CREATE | O_RDWR)) < 0){
+    printf("testdcache: create failed\n");
+    exit(1);
+  }
+  close(fd);
+
+  // a repeated lookup finds the same inode.
+  if(stat("dcd/f", &st) < 0 || stat("dcd/sub/../f", &st2) < 0){
+    printf("testdcache: stat failed\n");
+    exit(1);
+  }
+  if(st.ino != st2.ino){
+    printf("testdcache: two paths to one file differ\n");
+    exit(1);
+  }
+
+  // a removed name stays gone, and a new file under the old
+  // name is found, not the old one.
+  if(unlink("dcd/f") < 0){
+    printf("testdcache: unlink failed\n");
+    exit(1);
+  }
+  if(open("dcd/f", O_RDONLY) >= 0 || stat("dcd/sub/../f", &st2) == 0){
+    printf("testdcache: unlinked file still found\n");
+    exit(1);
+  }
+  if(mkdir("dcd/f") < 0){
+    printf("testdcache: mkdir over old name failed\n");
+    exit(1);
+  }
+  if(stat("dcd/f", &st2) < 0 || st2.type != T_DIR){
+    printf("testdcache: new directory not found\n");
+    exit(1);
+  }
+  if(unlink("dcd/f") < 0){
+    printf("testdcache: unlink of directory failed\n");
+    exit(1);
+  }
+
+  // a directory removed and made again loses its old entries.
+  if((fd = open("dcd/sub/f", O_CREATE | O_RDWR)) < 0){
+    printf("testdcache: create in sub failed\n");
+    exit(1);
+  }
+  close(fd);
+  if(stat("dcd/sub/f", &st) < 0 || unlink("dcd/sub/f") < 0 ||
+     unlink("dcd/sub") < 0 || mkdir("dcd/sub") < 0){
+    printf("testdcache: remaking sub failed\n");
+    exit(1);
+  }
+  if(stat("dcd/sub/f", &st) == 0){
+    printf("testdcache: file of removed directory still found\n");
+    exit(1);
+  }
+  if(stat("dcd/sub/..", &st) < 0 || stat("dcd", &st2) < 0 || st.ino != st2.ino){
+    printf("testdcache: remade directory's parent is wrong\n");
+    exit(1);
+  }
+
+  // unlink and create while others look the name up.
+  for(int i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("testdcache: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      looker();
+  }
+  for(int i = 0; i < NROUND; i++){
+    if((fd = open("dcd/f", O_CREATE | O_RDWR)) < 0){
+      printf("testdcache: create in loop failed\n");
+      exit(1);
+    }
+    if(write(fd, "x", 1) != 1){
+      printf("testdcache: write failed\n");
+      exit(1);
+    }
+    close(fd);
+    if(unlink("dcd/f") < 0){
+      printf("testdcache: unlink in loop failed\n");
+      exit(1);
+    }
+  }
+  for(int i = 0; i < NCHILD; i++)
+    if(wait(&xstatus) < 0 || xstatus != 0){
+      printf("testdcache: a lookup found a stale or wrong inode\n");
+      exit(1);
+    }
+
+  clean();
+  printf("testdcache: PASS\n");
+  exit(0);
+}
@@ -0,0 +1,149 @@
+#include "kernel/types.h"
+#include "kernel/futex.h"
+#include "user/user.h"
+
+// Test futex(): a futex-based mutex keeps threads' updates of
+// a plain counter from being lost, FUTEX_WAIT refuses to sleep
+// on a changed value, and FUTEX_REQUEUE wakes one waiter and
+// moves the rest.
+
+#define NTHREAD 4
+#define NINCR 2000
+#define STACKSZ 4096
+
+// a mutex: 0 unlocked, 1 locked, 2 locked with waiters.
+// unlocking an uncontended mutex makes no system call.
+volatile int mutex;
+int counter;      // guarded by mutex
+volatile int cond, cond2, waiting, released;
+
+static void*
+stack(void)
+{
+  char *s = malloc(STACKSZ);
+  if(s == 0){
+    printf("testfutex: malloc failed\n");
+    exit(1);
+  }
+  return s + STACKSZ;
+}
+
+static void
+lock(volatile int *m)
+{
+  int c = __sync_val_compare_and_swap(m, 0, 1);
+
+  if(c == 0)
+    return;
+  if(c != 2)
+    c = __sync_lock_test_and_set(m, 2);
+  while(c != 0){
+    futex((int*)m, FUTEX_WAIT, 2, 0);
+    c = __sync_lock_test_and_set(m, 2);
+  }
+}
+
+static void
+unlock(volatile int *m)
+{
+  if(__sync_fetch_and_sub(m, 1) != 1){
+    *m = 0;
+    __sync_synchronize();
+    futex((int*)m, FUTEX_WAKE, 1, 0);
+  }
+}
+
+static void
+incr(void *arg)
+{
+  for(int i = 0; i < NINCR; i++){
+    lock(&mutex);
+    int c = counter;
+    if(i % 256 == 0)
+      pause(1);   // sleep holding the lock, so others wait for it
+    counter = c + 1;
+    unlock(&mutex);
+  }
+  exit(0);
+}
+
+static void
+waiter(void *arg)
+{
+  __sync_fetch_and_add(&waiting, 1);
+  while(cond == 0)
+    futex((int*)&cond, FUTEX_WAIT, 0, 0);
+  __sync_fetch_and_add(&released, 1);
+  exit(0);
+}
+
+int
+main()
+{
+  int xstatus;
+
+  for(int i = 0; i < NTHREAD; i++)
+    if(clone(incr, 0, stack()) < 0){
+      printf("testfutex: clone failed\n");
+      exit(1);
+    }
+  for(int i = 0; i < NTHREAD; i++)
+    if(wait(&xstatus) < 0 || xstatus != 0){
+      printf("testfutex: thread failed\n");
+      exit(1);
+    }
+  if(counter != NTHREAD * NINCR){
+    printf("testfutex: mutex lost updates\n");
+    exit(1);
+  }
+
+  // no sleeping unless the value is as expected.
+  if(futex((int*)&cond, FUTEX_WAIT, 1, 0) != -1){
+    printf("testfutex: FUTEX_WAIT slept on a changed value\n");
+    exit(1);
+  }
+  if(futex((int*)&cond + 1, FUTEX_WAKE, 1, 0) != 0){
+    printf("testfutex: FUTEX_WAKE woke someone on an unused address\n");
+    exit(1);
+  }
+  if(futex((int*)((char*)&cond + 1), FUTEX_WAKE, 1, 0) != -1){
+    printf("testfutex: misaligned address accepted\n");
+    exit(1);
+  }
+
+  for(int i = 0; i < NTHREAD; i++)
+    if(clone(waiter, 0, stack()) < 0){
+      printf("testfutex: clone failed\n");
+      exit(1);
+    }
+  while(waiting < NTHREAD)
+    pause(1);
+  pause(10);    // let them get to sleep in the kernel
+
+  cond = 1;
+  if(futex((int*)&cond, FUTEX_REQUEUE, 1, (int*)&cond2) != 1){
+    printf("testfutex: FUTEX_REQUEUE did not wake one\n");
+    exit(1);
+  }
+  pause(10);
+  if(released != 1){
+    printf("testfutex: requeued waiters woke up\n");
+    exit(1);
+  }
+  if(futex((int*)&cond, FUTEX_WAKE, NTHREAD, 0) != 0){
+    printf("testfutex: waiters still on the old address\n");
+    exit(1);
+  }
+  if(futex((int*)&cond2, FUTEX_WAKE, NTHREAD, 0) != NTHREAD - 1){
+    printf("testfutex: waiters not moved to the new address\n");
+    exit(1);
+  }
+  for(int i = 0; i < NTHREAD; i++)
+    if(wait(&xstatus) < 0 || xstatus != 0){
+      printf("testfutex: waiter failed\n");
+      exit(1);
+    }
+
+  printf("testfutex: PASS\n");
+  exit(0);
+}
@@ -0,0 +1,86 @@
+#include "kernel/types.h"
+#include "user/user.h"
+
+// Test maxproc(): raising the limit lets more processes than
+// the default exist at once, lowering it below the number that
+// exist stops fork() without harming them, and the old limit
+// can be put back.
+
+#define NCHILD 150
+
+int
+main()
+{
+  int fds[2], pid, xstatus, oldlimit;
+  char c;
+
+  if((oldlimit = maxproc(0)) <= 0){
+    printf("testmaxproc: maxproc(0) failed\n");
+    exit(1);
+  }
+  if(maxproc(1 << 20) != -1){
+    printf("testmaxproc: huge limit accepted\n");
+    maxproc(oldlimit);
+    exit(1);
+  }
+  if(maxproc(NCHILD + 20) != oldlimit){
+    printf("testmaxproc: maxproc did not return the old limit\n");
+    maxproc(oldlimit);
+    exit(1);
+  }
+
+  // children wait for the pipe to close.
+  if(pipe(fds) < 0){
+    printf("testmaxproc: pipe failed\n");
+    maxproc(oldlimit);
+    exit(1);
+  }
+  for(int i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("testmaxproc: fork failed below the limit\n");
+      maxproc(oldlimit);
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[1]);
+      read(fds[0], &c, 1);
+      exit(0);
+    }
+  }
+
+  if(maxproc(NCHILD) != NCHILD + 20){
+    printf("testmaxproc: maxproc did not return the raised limit\n");
+    maxproc(oldlimit);
+    exit(1);
+  }
+  pid = fork();
+  if(pid == 0)
+    exit(0);
+  if(pid > 0){
+    printf("testmaxproc: fork succeeded above the limit\n");
+    maxproc(oldlimit);
+    exit(1);
+  }
+
+  close(fds[1]);
+  for(int i = 0; i < NCHILD; i++)
+    if(wait(&xstatus) < 0 || xstatus != 0){
+      printf("testmaxproc: child failed\n");
+      maxproc(oldlimit);
+      exit(1);
+    }
+
+  maxproc(oldlimit);
+  if((pid = fork()) < 0){
+    printf("testmaxproc: fork failed after restoring the limit\n");
+    maxproc(oldlimit);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(0);
+  wait(0);
+
+  printf("testmaxproc: PASS\n");
+  exit(0);
+}
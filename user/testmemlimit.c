@@ -0,0 +1,122 @@
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// Test per-process memory limits: eager and lazy heap growth
+// past the limit fail without hurting the parent, and a file
+// mapping larger than the limit can still be read, because
+// clean file pages are reclaimed.
+
+#define LIMIT 64   // pages
+
+int
+main()
+{
+  char buf[512];
+  struct memstat st;
+  int fd, pid, xstatus;
+
+  // a file of 2*LIMIT pages, each page filled with its number.
+  fd = open("limitfile", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("testmemlimit: cannot create limitfile\n");
+    exit(1);
+  }
+  for(int pg = 0; pg < 2*LIMIT; pg++){
+    memset(buf, 'a' + pg % 26, sizeof(buf));
+    for(int i = 0; i < 4096 / sizeof(buf); i++)
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+        printf("testmemlimit: write error\n");
+        unlink("limitfile");
+        exit(1);
+      }
+  }
+  close(fd);
+
+  // eager sbrk past the limit must fail.
+  pid = fork();
+  if(pid == 0){
+    memstat(0, &st);
+    if(memlimit(st.rss + 8) < 0){
+      printf("testmemlimit: memlimit failed\n");
+      unlink("limitfile");
+      exit(1);
+    }
+    if(memlimit(st.rss + 16) >= 0){
+      printf("testmemlimit: memlimit raised the limit\n");
+      unlink("limitfile");
+      exit(1);
+    }
+    if(sbrk(16 * 4096) != SBRK_ERROR){
+      printf("testmemlimit: sbrk past the limit succeeded\n");
+      unlink("limitfile");
+      exit(1);
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+
+  // touching lazily allocated pages past the limit kills the
+  // child, not the parent.
+  pid = fork();
+  if(pid == 0){
+    memstat(0, &st);
+    memlimit(st.rss + 8);
+    char *p = sbrklazy(16 * 4096);
+    for(int i = 0; i < 16; i++)
+      p[i * 4096] = 1;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("testmemlimit: child touched pages past its limit\n");
+    unlink("limitfile");
+    exit(1);
+  }
+
+  // a mapping twice the size of the limit can be read through,
+  // since clean file pages are reclaimed to make room.
+  pid = fork();
+  if(pid == 0){
+    fd = open("limitfile", O_RDONLY);
+    if(fd < 0){
+      printf("testmemlimit: cannot open limitfile\n");
+      unlink("limitfile");
+      exit(1);
+    }
+    char *p = mmap(0, 2*LIMIT*4096, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(p == (char*)-1){
+      printf("testmemlimit: mmap failed\n");
+      unlink("limitfile");
+      exit(1);
+    }
+    memstat(0, &st);
+    memlimit(st.rss + LIMIT / 2);
+    for(int pass = 0; pass < 2; pass++)
+      for(int pg = 0; pg < 2*LIMIT; pg++)
+        if(p[pg * 4096 + 100] != 'a' + pg % 26){
+          printf("testmemlimit: wrong data in mapping\n");
+          unlink("limitfile");
+          exit(1);
+        }
+    if(munmap(p, 2*LIMIT*4096) < 0){
+      printf("testmemlimit: munmap failed\n");
+      unlink("limitfile");
+      exit(1);
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("testmemlimit: reading a mapping larger than the limit failed\n");
+    unlink("limitfile");
+    exit(1);
+  }
+
+  unlink("limitfile");
+  printf("testmemlimit: PASS\n");
+  exit(0);
+}
@@ -61,6 +61,53 @@ int main() {
     exit(1);
   }
 
+  // read() and write() on a file, with the buffer in a mapping
+  // of the same file that is not yet faulted in.
+  char *w = (char*)mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  int fd2 = open("testfile", O_RDWR);
+  if (w == (char*)-1 || fd2 < 0) {
+    printf("test_mmap_basic: second mapping failed\n");
+    exit(1);
+  }
+  if (read(fd2, w, len) != len || memcmp(w, test_content, len) != 0) {
+    printf("test_mmap_basic: read into a mapping of the file failed\n");
+    exit(1);
+  }
+  if (munmap(w, 4096) < 0) {
+    printf("test_mmap_basic: munmap failed\n");
+    exit(1);
+  }
+  w = (char*)mmap(0, 4096, PROT_READ, MAP_SHARED, fd, 0);
+  if (w == (char*)-1 || write(fd2, w, len) != len || munmap(w, 4096) < 0) {
+    printf("test_mmap_basic: write from a mapping of the file failed\n");
+    exit(1);
+  }
+  close(fd2);
+
+  // The heap may not grow into a mapping just above it.
+  char *brk = sbrk(0);
+  char *q = (char*)(((uint64)brk + 4095) / 4096 * 4096 + 2*4096);
+  if ((char*)mmap(q, 4096, PROT_READ, MAP_PRIVATE, fd, 0) != q) {
+    printf("test_mmap_basic: mmap above the heap failed\n");
+    exit(1);
+  }
+  if (q[0] != 'H') {
+    printf("test_mmap_basic: wrong data above the heap\n");
+    exit(1);
+  }
+  if (sbrk(4*4096) != SBRK_ERROR || sbrklazy(4*4096) != SBRK_ERROR) {
+    printf("test_mmap_basic: heap grew into a mapping\n");
+    exit(1);
+  }
+  if (sbrk(4096) == SBRK_ERROR || sbrk(-4096) == SBRK_ERROR) {
+    printf("test_mmap_basic: heap cannot grow below a mapping\n");
+    exit(1);
+  }
+  if (q[0] != 'H' || munmap(q, 4096) < 0) {
+    printf("test_mmap_basic: mapping above the heap damaged\n");
+    exit(1);
+  }
+
   close(fd);
   unlink("testfile");  // Cleanup test file
   printf("test_mmap_basic: PASS\n");
@@ -0,0 +1,112 @@
+#include "kernel/types.h"
+#include "user/user.h"
+
+// Test spawn() and vfork(): spawn() starts a program in a new
+// process with copies of the caller's open files, and a vfork()
+// child shares the caller's memory, which waits until the child
+// calls exec() or exit().
+
+volatile int touched;
+
+// testspawn runs itself as the child program.
+static void
+child(int argc, char *argv[])
+{
+  if(argc == 3 && strcmp(argv[1], "exit") == 0)
+    exit(atoi(argv[2]));
+  if(argc == 3 && strcmp(argv[1], "write") == 0){
+    if(write(atoi(argv[2]), "ok", 2) != 2)
+      exit(1);
+    exit(0);
+  }
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *exitargs[] = { "testspawn", "exit", "3", 0 };
+  char *writeargs[] = { "testspawn", "write", "0", 0 };
+  char fdname[4], buf[4];
+  int fds[2], pid, xstatus;
+
+  if(argc > 1)
+    child(argc, argv);
+
+  // spawn() a program and collect its exit status.
+  if((pid = spawn("testspawn", exitargs)) < 0){
+    printf("testspawn: spawn failed\n");
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 3){
+    printf("testspawn: spawned child did not exit with 3\n");
+    exit(1);
+  }
+  if(spawn("nosuchprogram", exitargs) != -1){
+    printf("testspawn: spawn of a missing program succeeded\n");
+    exit(1);
+  }
+
+  // the spawned child writes to a pipe it inherits.
+  if(pipe(fds) < 0){
+    printf("testspawn: pipe failed\n");
+    exit(1);
+  }
+  fdname[0] = '0' + fds[1];
+  fdname[1] = 0;
+  writeargs[2] = fdname;
+  if((pid = spawn("testspawn", writeargs)) < 0){
+    printf("testspawn: spawn failed\n");
+    exit(1);
+  }
+  close(fds[1]);
+  if(read(fds[0], buf, 2) != 2 || buf[0] != 'o' || buf[1] != 'k'){
+    printf("testspawn: spawned child's write is missing\n");
+    exit(1);
+  }
+  close(fds[0]);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("testspawn: writing child failed\n");
+    exit(1);
+  }
+
+  // a vfork() child's stores are the caller's, which does not
+  // go on until the child exits.
+  pid = vfork();
+  if(pid == 0){
+    touched = 1;
+    pause(2);
+    touched = 2;
+    exit(5);
+  }
+  if(pid < 0){
+    printf("testspawn: vfork failed\n");
+    exit(1);
+  }
+  if(touched != 2){
+    printf("testspawn: vfork returned before the child exited\n");
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 5){
+    printf("testspawn: vfork child did not exit with 5\n");
+    exit(1);
+  }
+
+  // and one that calls exec() gives the memory back.
+  pid = vfork();
+  if(pid == 0){
+    exec("testspawn", exitargs);
+    exit(99);
+  }
+  if(pid < 0){
+    printf("testspawn: vfork failed\n");
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 3){
+    printf("testspawn: vfork child's exec failed\n");
+    exit(1);
+  }
+
+  printf("testspawn: PASS\n");
+  exit(0);
+}
@@ -0,0 +1,85 @@
+#include "kernel/types.h"
+#include "user/user.h"
+
+// Test sleepuntil() and pause(): sleepers wake no earlier than
+// their deadlines, and in deadline order, without waiting for
+// a whole scheduler tick.
+
+int
+main()
+{
+  uint64 t0, t1;
+  int fds[2], xstatus;
+  char c;
+
+  // a deadline in the past returns at once.
+  if(sleepuntil(0) != 0){
+    printf("testtimer: sleepuntil(0) failed\n");
+    exit(1);
+  }
+
+  // a short sleep ends on time, not at the next tick.
+  t0 = uptimeus();
+  if(sleepuntil(t0 + 5000) != 0){
+    printf("testtimer: sleepuntil failed\n");
+    exit(1);
+  }
+  t1 = uptimeus();
+  if(t1 < t0 + 5000){
+    printf("testtimer: woke before the deadline\n");
+    exit(1);
+  }
+  if(t1 > t0 + 5000 + 50000)
+    printf("testtimer: warning: woke %d us late\n", (int)(t1 - t0 - 5000));
+
+  // pause() still counts ticks.
+  int u0 = uptime();
+  if(pause(2) != 0){
+    printf("testtimer: pause failed\n");
+    exit(1);
+  }
+  if(uptime() - u0 < 2){
+    printf("testtimer: pause returned early\n");
+    exit(1);
+  }
+
+  // children with staggered deadlines wake in order.
+  if(pipe(fds) < 0){
+    printf("testtimer: pipe failed\n");
+    exit(1);
+  }
+  t0 = uptimeus();
+  for(int i = 3; i >= 0; i--){
+    int pid = fork();
+    if(pid < 0){
+      printf("testtimer: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      c = '0' + i;
+      sleepuntil(t0 + 20000 + i * 20000);
+      write(fds[1], &c, 1);
+      exit(0);
+    }
+  }
+  close(fds[1]);
+  for(int i = 0; i < 4; i++){
+    if(read(fds[0], &c, 1) != 1){
+      printf("testtimer: read failed\n");
+      exit(1);
+    }
+    if(c != '0' + i){
+      printf("testtimer: sleepers woke out of order\n");
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  for(int i = 0; i < 4; i++)
+    if(wait(&xstatus) < 0 || xstatus != 0){
+      printf("testtimer: child failed\n");
+      exit(1);
+    }
+
+  printf("testtimer: PASS\n");
+  exit(0);
+}
@@ -1,12 +1,7 @@
 #define SBRK_ERROR ((char *)-1)
 
-// mmap constants
-#define PROT_READ  0x1
-#define PROT_WRITE 0x2
-#define MAP_SHARED  0x01
-#define MAP_PRIVATE 0x02
-
 struct stat;
+struct memstat;
 
 // system calls
 int fork(void);
@@ -32,6 +27,18 @@ int pause(int);
 int uptime(void);
 void *mmap(void *addr, int length, int prot, int flags, int fd, int offset);
 int munmap(void *addr, int length);
+int memstat(int, struct memstat*);
+int memlimit(int);
+int clone(void (*)(void*), void*, void*);
+int futex(int*, int, int, int*);
+int setpriority(int, int);
+int sched_setaffinity(int, uint64);
+int sched_getaffinity(int, uint64*);
+int sleepuntil(uint64);
+uint64 uptimeus(void);
+int maxproc(int);
+int vfork(void);
+int spawn(const char*, char**);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -2713,7 +2713,7 @@ lazy_sbrk(char *s)
     p = sbrklazy(0);
   }
 
-  int n = TRAPFRAME-PGSIZE-(uint64)p;
+  int n = USERTOP-PGSIZE-(uint64)p;
 
   char *p1 = sbrklazy(n);
   if (p1 < 0 || p1 != p) {
@@ -2722,8 +2722,8 @@ lazy_sbrk(char *s)
   }
 
   p = sbrk(PGSIZE);
-  if (p < 0 || (uint64)p != TRAPFRAME-PGSIZE) {
-    printf("sbrk(%d) returned %p, not expected TRAPFRAME-PGSIZE\n", PGSIZE, p);
+  if (p < 0 || (uint64)p != USERTOP-PGSIZE) {
+    printf("sbrk(%d) returned %p, not expected USERTOP-PGSIZE\n", PGSIZE, p);
     exit(1);
   }
 
@@ -44,3 +44,15 @@ entry("pause");
 entry("uptime");
 entry("mmap");
 entry("munmap");
+entry("memstat");
+entry("memlimit");
+entry("clone");
+entry("futex");
+entry("setpriority");
+entry("sched_setaffinity");
+entry("sched_getaffinity");
+entry("sleepuntil");
+entry("uptimeus");
+entry("maxproc");
+entry("vfork");
+entry("spawn");